@@ -1,3 +1,4 @@
+#define LOG_MODULE LOG_SQL
 #include "sql_conn_pool.h"
 
 sql_conn_pool::sql_conn_pool()
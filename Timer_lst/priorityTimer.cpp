@@ -1,9 +1,9 @@
-
+#define LOG_MODULE LOG_TIMER
 #include "priorityTimer.h"
 
-timer_node::timer_node(int ns)
+timer_node::timer_node(int ms)
 {
-    this->expire_ = Clock::now() + SEC(ns);
+    this->expire_ = Clock::now() + MS(ms);
     this->deleted_ = false;
 }
 
@@ -21,10 +21,10 @@ bool timer_node::isVaild()
 timerQueue::timerQueue() {}
 timerQueue::~timerQueue() {}
 
-SPTNode timerQueue::add_timer(int ns)
+SPTNode timerQueue::add_timer(int ms)
 {
-    //SPTNode new_node(new timer_node(user_data,ns));// 下面这种方式更高效
-    SPTNode new_node = std::make_shared<timer_node>(ns);
+    //SPTNode new_node(new timer_node(user_data,ms));// 下面这种方式更高效
+    SPTNode new_node = std::make_shared<timer_node>(ms);
     timer_queue.push(new_node);
 
     return new_node;
@@ -57,20 +57,3 @@ void timerQueue::tick() {
             break;
     }
 }
-
-int timerQueue::changeGap()
-{
-    if (!timer_queue.empty())
-    {
-        auto temp = timer_queue.top()->getExpire() - Clock::now();
-        // 间隔时间改为最小超时时间+1秒
-        return temp.count() / 1000000000 + 1;
-    }
-    else{
-        return 4 * TIMESLOT;// 无连接，间隔拉长
-    }
-}
-
-
-
-
@@ -11,7 +11,7 @@
 
 #include"../http/http_conn.h"
 
-#define TIMESLOT 5  //时间间隔，每次请求延长超时间为此间隔的三倍
+#define TIMESLOT 5000  //时间间隔(毫秒)，每次请求延长超时间为此间隔的三倍
 
 // 前向声明
 class http_conn;
@@ -21,16 +21,16 @@ using SPHttp = std::shared_ptr<http_conn>;
 // 给管理定时器类的sharedptr起别名
 using SPTNode = std::shared_ptr<timer_node>; 
 
-// 统一规范化时间
-using Clock = std::chrono::system_clock;// 获取当前时间
+// 统一规范化时间，使用单调时钟，和timerfd的CLOCK_MONOTONIC是同一个时钟，不受系统时间修改影响
+using Clock = std::chrono::steady_clock;// 获取当前时间
 using time_p = Clock::time_point;       // 统一时间数据类型
-using SEC = std::chrono::seconds;       // 把int转换为秒
+using MS = std::chrono::milliseconds;   // 把int转换为毫秒
 
 // 定时器类
 class timer_node {
 public:
     // 构造函数，初始化参数列表
-    timer_node(int ns);
+    timer_node(int ms);
     // 指向定时器的sharedptr被列队pop后，引用计数为0，定时器会调用析构函数
     ~timer_node();
     // 删除标记，用来区分资源回收方式
@@ -40,8 +40,8 @@ public:
     void cancelDeleted() { deleted_ = false; }
     // 判断是否有效，超时返回false
     bool isVaild();
-    // 更新超时时间
-    void upadte(int ns) { this->expire_ = Clock::now() + SEC(ns); }
+    // 更新超时时间，单位毫秒
+    void upadte(int ms) { this->expire_ = Clock::now() + MS(ms); }
     // 获取超时时间
     time_p getExpire() const { return this->expire_; }
 
@@ -68,12 +68,14 @@ public:
     timerQueue();
     ~timerQueue();
 
-    // 添加定时器，返回这个定时器
-    SPTNode add_timer(int ns);
+    // 添加定时器，返回这个定时器，超时时间单位毫秒
+    SPTNode add_timer(int ms);
     // 心搏函数,根据定时器超时时间，清理超时连接
     void tick();
-    // 更改定时器间隔，取最小超时时间+1秒为下一次定时触发时间，减少信号触发次数
-    int changeGap();
+    // 是否没有定时器
+    bool empty() const { return timer_queue.empty(); }
+    // 最早的超时时间，反应堆用它设置timerfd，队列不能为空
+    time_p nextExpire() const { return timer_queue.top()->getExpire(); }
 
 private:
     // 使用优先队列实现定时器堆，入队自动调整，保持最小堆，出队也会自动调整，同时定时器sharedptr会把
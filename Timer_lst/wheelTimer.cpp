@@ -0,0 +1,266 @@
+#define LOG_MODULE LOG_TIMER
+#include "wheelTimer.h"
+#include "../http/http_conn.h"
+
+timer_node::timer_node()
+{
+    this->prev = this->next = nullptr;
+    this->user_data = nullptr;
+    this->wheel_ = nullptr;
+    this->tick_ = 0;
+    this->level_ = -1;
+    this->slot_ = 0;
+    this->deleted_ = false;
+}
+
+timer_node::~timer_node()
+{
+    if (isLinked()) {
+        wheel_->del_timer(this);
+    }
+}
+
+bool timer_node::isVaild()
+{
+    if (this->expire_ <= Clock::now()){
+        return false;
+    }
+    return true;
+}
+
+void timer_node::upadte(int ms)
+{
+    this->expire_ = Clock::now() + MS(ms);
+    wheel_->adjust(this);
+}
+
+// 分层时间轮
+timerWheel::timerWheel() : m_base(Clock::now()), m_current(0), m_count(0)
+{
+    for (int i = 0; i < TVR_SIZE; ++i) {
+        m_tv1[i].prev = m_tv1[i].next = &m_tv1[i];
+    }
+    for (int l = 0; l < LEVELS - 1; ++l) {
+        for (int i = 0; i < TVN_SIZE; ++i) {
+            m_tvn[l][i].prev = m_tvn[l][i].next = &m_tvn[l][i];
+        }
+    }
+    memset(m_bitmap, 0, sizeof(m_bitmap));
+}
+
+timerWheel::~timerWheel()
+{
+    for (int level = 0; level < LEVELS; ++level) {
+        int size = level == 0 ? TVR_SIZE : TVN_SIZE;
+        for (int slot = 0; slot < size; ++slot) {
+            timer_link *head = slot_head(level, slot);
+            while (head->next != head) {
+                unlink(static_cast<timer_node *>(head->next));
+            }
+        }
+    }
+}
+
+timer_link *timerWheel::slot_head(int level, int slot)
+{
+    return level == 0 ? &m_tv1[slot] : &m_tvn[level - 1][slot];
+}
+
+uint64_t timerWheel::to_tick(time_p t) const
+{
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t - m_base).count();
+    if (ns <= 0) return 0;
+    return (ns + 999999) / 1000000;
+}
+
+void timerWheel::link(timer_node *node)
+{
+    uint64_t expires = node->tick_;
+    // 已经过期的定时器放到下一个要处理的槽
+    if (expires < m_current) expires = m_current;
+    uint64_t idx = expires - m_current;
+
+    int level = 0;
+    int slot;
+    if (idx < TVR_SIZE) {
+        slot = expires & TVR_MASK;
+    }
+    else {
+        // 超出最高层的范围，先放到最高层最远的槽，下放时会重新计算
+        if (idx >> (TVR_BITS + (LEVELS - 1) * TVN_BITS)) {
+            expires = m_current + (1ULL << (TVR_BITS + (LEVELS - 1) * TVN_BITS)) - 1;
+            idx = expires - m_current;
+        }
+        level = 1;
+        while (idx >> (TVR_BITS + level * TVN_BITS)) {
+            ++level;
+        }
+        slot = (expires >> (TVR_BITS + (level - 1) * TVN_BITS)) & TVN_MASK;
+    }
+
+    // 挂到槽的链表尾部，同一个槽内先加入的先处理
+    timer_link *head = slot_head(level, slot);
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+    node->level_ = level;
+    node->slot_ = slot;
+    m_bitmap[level][slot >> 6] |= 1ULL << (slot & 63);
+}
+
+void timerWheel::unlink(timer_node *node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    timer_link *head = slot_head(node->level_, node->slot_);
+    if (head->next == head) {
+        m_bitmap[node->level_][node->slot_ >> 6] &= ~(1ULL << (node->slot_ & 63));
+    }
+    node->prev = node->next = nullptr;
+    node->level_ = -1;
+}
+
+void timerWheel::cascade(int level, int slot)
+{
+    timer_link *head = slot_head(level, slot);
+    while (head->next != head) {
+        timer_node *node = static_cast<timer_node *>(head->next);
+        unlink(node);
+        link(node);
+    }
+}
+
+void timerWheel::add_timer(timer_node *node, int ms)
+{
+    // 时间轮空闲了很久，先把刻度追上来，新定时器能直接放到低层
+    if (m_count == 0) {
+        uint64_t now = to_tick(Clock::now());
+        if (now > m_current) m_current = now;
+    }
+    node->wheel_ = this;
+    node->expire_ = Clock::now() + MS(ms);
+    node->tick_ = to_tick(node->expire_);
+    link(node);
+    ++m_count;
+}
+
+void timerWheel::del_timer(timer_node *node)
+{
+    unlink(node);
+    --m_count;
+}
+
+void timerWheel::adjust(timer_node *node)
+{
+    if (node->level_ >= 0) {
+        unlink(node);
+    }
+    node->tick_ = to_tick(node->expire_);
+    link(node);
+}
+
+uint64_t timerWheel::next_tick() const
+{
+    uint64_t best = UINT64_MAX;
+
+    // 第0层：当前位置之后的槽在这一圈到期，之前的槽在下一圈到期
+    uint64_t cur = m_current & TVR_MASK;
+    uint64_t base = m_current - cur;
+    for (int w = 0; w < TVR_SIZE / 64; ++w) {
+        uint64_t bits = m_bitmap[0][w];
+        while (bits) {
+            uint64_t slot = w * 64 + __builtin_ctzll(bits);
+            uint64_t t = slot >= cur ? base + slot : base + TVR_SIZE + slot;
+            if (t < best) best = t;
+            bits &= bits - 1;
+        }
+    }
+
+    // 第1~4层：槽在刻度到达本层单位的整数倍、且该层下标等于槽号时下放
+    for (int level = 1; level < LEVELS; ++level) {
+        uint64_t bits = m_bitmap[level][0];
+        if (!bits) continue;
+        int shift = TVR_BITS + (level - 1) * TVN_BITS;
+        uint64_t unit = 1ULL << shift;
+        uint64_t t0 = (m_current + unit - 1) & ~(unit - 1);
+        uint64_t idx0 = (t0 >> shift) & TVN_MASK;
+        while (bits) {
+            uint64_t slot = __builtin_ctzll(bits);
+            uint64_t t = t0 + ((slot - idx0) & TVN_MASK) * unit;
+            if (t < best) best = t;
+            bits &= bits - 1;
+        }
+    }
+    return best;
+}
+
+time_p timerWheel::nextExpire() const
+{
+    return m_base + MS(next_tick());
+}
+
+void timerWheel::tick()
+{
+    auto now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - m_base).count();
+    uint64_t now = now_ns / 1000000;
+
+    while (m_count > 0)
+    {
+        // 直接跳到下一个需要处理的刻度，中间的刻度没有定时器，也没有需要下放的槽
+        uint64_t t = next_tick();
+        if (t > now) {
+            break;
+        }
+        m_current = t;
+        int index = m_current & TVR_MASK;
+        // 第0层转完一圈，逐层下放
+        if (index == 0) {
+            for (int level = 1; level < LEVELS; ++level) {
+                int slot = (m_current >> (TVR_BITS + (level - 1) * TVN_BITS)) & TVN_MASK;
+                cascade(level, slot);
+                if (slot != 0) break;
+            }
+        }
+        ++m_current;
+
+        // 先把到期的槽整体摘下，回调中重新加入的定时器不会在本轮被再次处理
+        timer_link expired;
+        timer_link *head = &m_tv1[index];
+        if (head->next == head) {
+            continue;
+        }
+        expired.next = head->next;
+        expired.prev = head->prev;
+        expired.next->prev = &expired;
+        expired.prev->next = &expired;
+        head->prev = head->next = head;
+        m_bitmap[0][index >> 6] &= ~(1ULL << (index & 63));
+
+        while (expired.next != &expired)
+        {
+            timer_node *temp_timer = static_cast<timer_node *>(expired.next);
+            expired.next = temp_timer->next;
+            temp_timer->next->prev = &expired;
+            temp_timer->prev = temp_timer->next = nullptr;
+            temp_timer->level_ = -1;
+
+            http_conn *temp_conn = temp_timer->user_data;
+            // 如果未被标记，断开连接，标记删除，更新为容忍时间，期间不删除定时器和连接信息
+            if (!temp_timer->isDeleted())
+            {
+                temp_conn->close_conn();
+                LOG_INFO("Normally close to client(%s) cfd(%d)",
+                    inet_ntoa(temp_conn->get_address()->sin_addr), temp_conn->get_sockfd());
+                continue;
+            }
+            // 如果已经被标记了，说明容忍时间已经到了，释放连接对象，定时器已经摘下，随连接对象一起销毁
+            --m_count;
+            temp_conn->release_conn();
+        }
+    }
+    // 到now为止都处理过了
+    if (m_current <= now) {
+        m_current = now + 1;
+    }
+}
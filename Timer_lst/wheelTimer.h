@@ -0,0 +1,112 @@
+#ifndef WHEELTIMER_H
+#define WHEELTIMER_H
+
+#include <iostream>
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <chrono>
+
+#define TIMESLOT 5000  //时间间隔(毫秒)，每次请求延长超时间为此间隔的三倍
+
+// 前向声明，这里不能包含http_conn.h，http_conn中直接嵌入了timer_node，需要它的完整定义
+class http_conn;
+class timerWheel;
+
+// 统一规范化时间，使用单调时钟，和timerfd的CLOCK_MONOTONIC是同一个时钟，不受系统时间修改影响
+using Clock = std::chrono::steady_clock;// 获取当前时间
+using time_p = Clock::time_point;       // 统一时间数据类型
+using MS = std::chrono::milliseconds;   // 把int转换为毫秒
+
+// 双向循环链表的链接部分，时间轮每个槽位有一个哨兵
+struct timer_link {
+    timer_link *prev;
+    timer_link *next;
+};
+
+// 定时器类，侵入式：直接嵌入在连接对象中，随连接对象一起创建和销毁，时间轮只负责链接，
+// 添加定时器不需要分配内存，连接和定时器之间是普通指针，事件分发时没有引用计数操作
+class timer_node : public timer_link {
+public:
+    timer_node();
+    // 还在时间轮中就先摘下
+    ~timer_node();
+    // 删除标记，用来区分资源回收方式
+    void setdeleted() { deleted_ = true; }
+    // 判断是否标记删除
+    bool isDeleted() { return deleted_; }
+    void cancelDeleted() { deleted_ = false; }
+    // 判断是否有效，超时返回false
+    bool isVaild();
+    // 更新超时时间，单位毫秒，从原槽位摘下挂到新槽位，O(1)
+    void upadte(int ms);
+    // 获取超时时间
+    time_p getExpire() const { return this->expire_; }
+    // 是否在时间轮中
+    bool isLinked() const { return level_ >= 0; }
+
+public:
+    // 所在的连接对象，由连接对象构造时设置
+    http_conn *user_data;
+
+private:
+    friend class timerWheel;
+    timerWheel *wheel_; // 所属时间轮
+    time_p expire_;     // 超时时间
+    uint64_t tick_;     // 超时时间对应的时间轮刻度
+    int level_;         // 所在的层，-1表示不在时间轮中
+    int slot_;          // 所在的槽位
+    bool deleted_;      // 删除标记
+};
+
+/*
+    分层时间轮，和Linux内核的定时器轮一样的结构，一个刻度为1毫秒
+    第0层256个槽，每个槽1毫秒；第1~4层各64个槽，每个槽是下一层一整圈的时间，最大约49天
+    1.添加、刷新、删除只是链表操作，O(1)
+    2.高层的槽在低层转完一圈时整体下放(cascade)，最终在第0层的槽中到期，所以按超时时间的先后(毫秒级)处理
+    3.每层用位图记录非空的槽，可以直接算出下一次需要处理的时间，用来设置timerfd，空闲时不会空转
+*/
+class timerWheel {
+public:
+    timerWheel();
+    // 摘下所有还在时间轮中的定时器，定时器本身属于连接对象，不在这里释放
+    ~timerWheel();
+
+    // 添加定时器，超时时间单位毫秒
+    void add_timer(timer_node *node, int ms);
+    // 超时时间改变后，把定时器放到新的槽位
+    void adjust(timer_node *node);
+    // 删除定时器
+    void del_timer(timer_node *node);
+    // 心搏函数,处理所有已经到期的槽，清理超时连接
+    void tick();
+    // 是否没有定时器
+    bool empty() const { return m_count == 0; }
+    // 下一次需要处理的时间(槽到期或者高层的槽下放)，反应堆用它设置timerfd，时间轮不能为空
+    time_p nextExpire() const;
+
+private:
+    static const int TVR_BITS = 8;              // 第0层的位数
+    static const int TVN_BITS = 6;              // 第1~4层的位数
+    static const int TVR_SIZE = 1 << TVR_BITS;
+    static const int TVN_SIZE = 1 << TVN_BITS;
+    static const int TVR_MASK = TVR_SIZE - 1;
+    static const int TVN_MASK = TVN_SIZE - 1;
+    static const int LEVELS = 5;
+
+    uint64_t to_tick(time_p t) const;   // 时间转换为刻度，向上取整，保证不会提前到期
+    uint64_t next_tick() const;         // 下一次需要处理的刻度
+    void link(timer_node *node);        // 按刻度挂到对应的层和槽
+    void unlink(timer_node *node);      // 从所在的槽摘下
+    void cascade(int level, int slot);  // 把高层的一个槽下放到低层
+    timer_link *slot_head(int level, int slot);
+
+private:
+    timer_link m_tv1[TVR_SIZE];             // 第0层
+    timer_link m_tvn[LEVELS - 1][TVN_SIZE]; // 第1~4层
+    uint64_t m_bitmap[LEVELS][TVR_SIZE / 64];// 非空槽位图，第1~4层只用第一个字
+    time_p m_base;          // 刻度0对应的时间
+    uint64_t m_current;     // 下一个要处理的刻度，之前的刻度都已经处理过了
+    size_t m_count;         // 定时器个数
+};
+
+#endif
@@ -0,0 +1,259 @@
+#include "chain_buffer.h"
+#include <string.h>
+#include <algorithm>
+
+// 线程本地的空闲块缓存，线程退出时还给全局空闲链表
+struct local_blocks {
+    buffer_block *head;
+    int count;
+
+    local_blocks() : head(nullptr), count(0) {}
+    ~local_blocks() {
+        block_pool *pool = block_pool::GetInstance();
+        while (head) {
+            buffer_block *blk = head;
+            head = blk->next;
+            pool->put_global(blk);
+        }
+    }
+};
+
+static thread_local local_blocks t_blocks;
+
+block_pool::block_pool() : m_free(nullptr), m_free_count(0), m_budget(0), m_used(0)
+{
+}
+
+block_pool::~block_pool()
+{
+    while (m_free) {
+        buffer_block *blk = m_free;
+        m_free = blk->next;
+        delete[] reinterpret_cast<char *>(blk);
+    }
+}
+
+buffer_block *block_pool::get()
+{
+    buffer_block *blk = t_blocks.head;
+    if (blk) {
+        t_blocks.head = blk->next;
+        --t_blocks.count;
+    }
+    else {
+        blk = get_global();
+    }
+    m_used.fetch_add(1, std::memory_order_relaxed);
+    blk->next = nullptr;
+    blk->begin = blk->end = 0;
+    return blk;
+}
+
+void block_pool::put(buffer_block *blk)
+{
+    m_used.fetch_sub(1, std::memory_order_relaxed);
+    if (t_blocks.count < LOCAL_FREE_BLOCKS) {
+        blk->next = t_blocks.head;
+        t_blocks.head = blk;
+        ++t_blocks.count;
+        return;
+    }
+    put_global(blk);
+}
+
+buffer_block *block_pool::get_global()
+{
+    m_lock.lock();
+    buffer_block *blk = m_free;
+    if (blk) {
+        m_free = blk->next;
+        --m_free_count;
+    }
+    m_lock.unlock();
+
+    if (!blk) {
+        // 块头和数据区一起分配
+        blk = reinterpret_cast<buffer_block *>(new char[sizeof(buffer_block) + BUFFER_BLOCK_SIZE]);
+    }
+    return blk;
+}
+
+void block_pool::put_global(buffer_block *blk)
+{
+    m_lock.lock();
+    if (m_free_count < MAX_FREE_BLOCKS) {
+        blk->next = m_free;
+        m_free = blk;
+        ++m_free_count;
+        blk = nullptr;
+    }
+    m_lock.unlock();
+
+    if (blk) {
+        delete[] reinterpret_cast<char *>(blk);
+    }
+}
+
+chain_buffer::chain_buffer() : m_head(nullptr), m_tail(nullptr), m_size(0)
+{
+}
+
+chain_buffer::~chain_buffer()
+{
+    release();
+}
+
+buffer_pos chain_buffer::end_pos() const
+{
+    buffer_pos pos = { m_tail, m_tail ? m_tail->end : 0 };
+    return pos;
+}
+
+ssize_t chain_buffer::read_fd(int fd, int max)
+{
+    // 先读到尾块的剩余空间，不够的部分读到栈上，再拷贝到新块
+    char extra[65536];
+    struct iovec iov[2];
+    int count = 0;
+    int space = std::min(tail_space(), max);
+    if (space > 0) {
+        iov[count].iov_base = tail_ptr();
+        iov[count].iov_len = space;
+        ++count;
+    }
+    if (max > space) {
+        iov[count].iov_base = extra;
+        iov[count].iov_len = std::min((int)sizeof(extra), max - space);
+        ++count;
+    }
+    ssize_t n = readv(fd, iov, count);
+    if (n <= 0) {
+        return n;
+    }
+    if (n <= space) {
+        commit(n);
+    }
+    else {
+        if (space > 0) {
+            commit(space);
+        }
+        append(extra, n - space);
+    }
+    return n;
+}
+
+void chain_buffer::append(const char *data, int len)
+{
+    while (len > 0) {
+        char *dst = reserve(1);
+        int n = std::min(len, m_tail->space());
+        memcpy(dst, data, n);
+        commit(n);
+        data += n;
+        len -= n;
+    }
+}
+
+char *chain_buffer::reserve(int len)
+{
+    if (!m_tail || m_tail->space() < len) {
+        buffer_block *blk = block_pool::GetInstance()->get();
+        if (m_tail) {
+            m_tail->next = blk;
+        }
+        else {
+            m_head = blk;
+        }
+        m_tail = blk;
+    }
+    return tail_ptr();
+}
+
+void chain_buffer::normalize(buffer_pos &pos) const
+{
+    if (!pos.blk) {
+        if (!m_head) {
+            return;
+        }
+        pos.blk = m_head;
+        pos.off = m_head->begin;
+    }
+    // 不是尾块的块不会再写入，读到末尾就可以移到下一块
+    while (pos.off >= pos.blk->end && pos.blk->next) {
+        pos.blk = pos.blk->next;
+        pos.off = pos.blk->begin;
+    }
+}
+
+int chain_buffer::bytes_from(buffer_pos pos) const
+{
+    normalize(pos);
+    if (!pos.blk) {
+        return 0;
+    }
+    int n = pos.blk->end - pos.off;
+    for (buffer_block *blk = pos.blk->next; blk; blk = blk->next) {
+        n += blk->end - blk->begin;
+    }
+    return n;
+}
+
+void chain_buffer::copy_out(buffer_pos &pos, std::string &out, int len) const
+{
+    normalize(pos);
+    while (len > 0) {
+        int n = std::min(len, pos.blk->end - pos.off);
+        out.append(pos.blk->data() + pos.off, n);
+        pos.off += n;
+        len -= n;
+        if (len > 0) {
+            pos.blk = pos.blk->next;
+            pos.off = pos.blk->begin;
+        }
+    }
+}
+
+void chain_buffer::consume(buffer_pos pos)
+{
+    normalize(pos);
+    if (!pos.blk) {
+        return;
+    }
+    block_pool *pool = block_pool::GetInstance();
+    while (m_head != pos.blk) {
+        buffer_block *blk = m_head;
+        m_head = blk->next;
+        m_size -= blk->end - blk->begin;
+        pool->put(blk);
+    }
+    m_size -= pos.off - m_head->begin;
+    m_head->begin = pos.off;
+}
+
+void chain_buffer::clear()
+{
+    if (!m_head) {
+        return;
+    }
+    block_pool *pool = block_pool::GetInstance();
+    while (m_head->next) {
+        buffer_block *blk = m_head->next;
+        m_head->next = blk->next;
+        pool->put(blk);
+    }
+    m_head->begin = m_head->end = 0;
+    m_tail = m_head;
+    m_size = 0;
+}
+
+void chain_buffer::release()
+{
+    block_pool *pool = block_pool::GetInstance();
+    while (m_head) {
+        buffer_block *blk = m_head;
+        m_head = blk->next;
+        pool->put(blk);
+    }
+    m_tail = nullptr;
+    m_size = 0;
+}
@@ -0,0 +1,119 @@
+#ifndef CHAIN_BUFFER_H
+#define CHAIN_BUFFER_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <string>
+#include <atomic>
+#include "../lock/locker.h"
+
+#define BUFFER_BLOCK_SIZE 4096     // 缓冲块的大小，一行请求头或响应头不能超过它
+#define MAX_FREE_BLOCKS 1024       // 全局空闲链表最多保留的块数，多出的块还给系统
+#define LOCAL_FREE_BLOCKS 32       // 每个线程本地缓存的块数
+
+// 缓冲块，数据区紧跟在块头后面，一次分配
+struct buffer_block {
+    buffer_block *next;
+    int begin;  // 可读数据的起点，只有链表头的块会大于0
+    int end;    // 可读数据的终点，也是下一次写入的位置
+
+    char *data() { return reinterpret_cast<char *>(this + 1); }
+    int space() const { return BUFFER_BLOCK_SIZE - end; }
+};
+
+// 缓冲区中的位置：所在的块和块内偏移，块为空表示缓冲区开头
+struct buffer_pos {
+    buffer_block *blk;
+    int off;
+};
+
+/*
+    缓冲块池，所有连接共享，读写缓冲区都从这里取块
+    1.连接只在有数据到达时取块，响应发送完就全部归还，空闲的长连接不占缓冲区，内存随活跃请求数增长而不是连接数
+    2.每个线程先用本地缓存，不加锁；本地缓存满了或者空了再访问全局空闲链表，用互斥锁保护
+    3.全局空闲链表超过MAX_FREE_BLOCKS时直接释放，突发流量过后内存能降下来
+    4.内存预算：使用中的块超过预算时，反应堆拒绝新的请求(503)，已经在处理的请求不受影响
+*/
+class block_pool
+{
+public:
+    // 单例模式
+    static block_pool *GetInstance() {
+        static block_pool pool;
+        return &pool;
+    }
+
+    // 设置内存预算，单位字节，0表示不限制
+    void set_budget(size_t bytes) { m_budget = bytes / BUFFER_BLOCK_SIZE; }
+    // 使用中的块是否已经达到预算
+    bool over_budget() const { return m_budget > 0 && m_used.load(std::memory_order_relaxed) >= m_budget; }
+    long used() const { return m_used.load(std::memory_order_relaxed); } // 使用中的块数
+
+    buffer_block *get();            // 取一个空块
+    void put(buffer_block *blk);    // 归还一个块
+
+private:
+    block_pool();
+    ~block_pool();
+
+    friend struct local_blocks;
+    buffer_block *get_global();
+    void put_global(buffer_block *blk);
+
+    locker m_lock;
+    buffer_block *m_free;   // 全局空闲链表
+    int m_free_count;
+    long m_budget;                  // 预算块数，0表示不限制
+    std::atomic<long> m_used;       // 已经取出、还没归还的块数
+};
+
+/*
+    链式缓冲区：由固定大小的缓冲块组成的单链表，只在尾部追加，从头部消费
+    1.容量不够时追加新块，已有的数据不移动，指向缓冲区的指针一直有效，大请求不需要重新分配一整块连续内存
+    2.读：readv同时读到尾块剩余空间和栈上的临时空间，读多了再拷贝到新块，一次系统调用读完
+    3.写：每个块是一段连续内存，直接作为writev的一个iovec
+    4.小请求只占一个块，请求解析和原来一样直接在块内进行
+    不是线程安全的，同一时刻只能由一个线程使用
+*/
+class chain_buffer
+{
+public:
+    chain_buffer();
+    ~chain_buffer();
+
+    int size() const { return m_size; }     // 可读的字节数
+    buffer_block *head() const { return m_head; }
+    buffer_pos end_pos() const;             // 当前末尾的位置
+
+    // 从fd读一次，最多读max字节，返回值和readv相同
+    ssize_t read_fd(int fd, int max);
+    // 追加数据，按需追加新块
+    void append(const char *data, int len);
+    // 保证尾块有len字节连续空间(len不超过BUFFER_BLOCK_SIZE)，不够时追加新块，返回写入位置
+    char *reserve(int len);
+    // reserve之后确认写入了len字节
+    void commit(int len) { m_tail->end += len; m_size += len; }
+    // 尾块剩余的连续空间
+    int tail_space() const { return m_tail ? m_tail->space() : 0; }
+    char *tail_ptr() const { return m_tail->data() + m_tail->end; }
+
+    // 位置在块末尾并且后面还有块时，移到下一块开头；块为空时移到缓冲区开头
+    void normalize(buffer_pos &pos) const;
+    // 从pos开始到末尾的字节数
+    int bytes_from(buffer_pos pos) const;
+    // 从pos开始拷贝len字节到out末尾，pos移到拷贝的数据之后，调用者保证数据足够
+    void copy_out(buffer_pos &pos, std::string &out, int len) const;
+    // pos之前的数据已经处理完，前面的整块归还
+    void consume(buffer_pos pos);
+    // 清空数据，只保留第一个块，同一个连接下一次使用时不用再取块
+    void clear();
+    // 清空数据，所有块都归还给缓冲块池
+    void release();
+
+private:
+    buffer_block *m_head;
+    buffer_block *m_tail;
+    int m_size;
+};
+
+#endif
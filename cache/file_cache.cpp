@@ -0,0 +1,282 @@
+#include "file_cache.h"
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#include "../logs/log.h"
+
+// 会让缓存中的文件失效的事件
+#define FILE_EVENTS (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | \
+                     IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+cached_file::~cached_file()
+{
+    if (addr) {
+        munmap(addr, size);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+int make_etag(char *buf, int len, ino_t ino, off_t size, time_t mtime, long mtime_ns, bool gzip)
+{
+    return snprintf(buf, len, "\"%lx-%lx-%lx.%lx%s\"", (unsigned long)ino, (unsigned long)size,
+        (unsigned long)mtime, (unsigned long)mtime_ns, gzip ? "-gz" : "");
+}
+
+int http_date(char *buf, int len, time_t t)
+{
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    return strftime(buf, len, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+time_t parse_http_date(const char *str)
+{
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    if (!strptime(str, "%a, %d %b %Y %H:%M:%S GMT", &tm)) {
+        return -1;
+    }
+    return timegm(&tm);
+}
+
+file_cache::file_cache() : m_gen(0), m_inotify_fd(-1), m_enabled(false), m_map(true), m_hits(0), m_misses(0)
+{
+}
+
+// inotify线程阻塞在read上，进程退出时直接结束，这里不关闭inotify描述符
+file_cache::~file_cache()
+{
+}
+
+bool file_cache::init(const char *root, bool map_files)
+{
+    m_map = map_files;
+    m_root = root;
+    while (m_root.size() > 1 && m_root.back() == '/') {
+        m_root.pop_back();
+    }
+    m_inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (m_inotify_fd < 0) {
+        LOG_ERROR("inotify_init1 failure, file cache disabled: %s", strerror(errno));
+        return false;
+    }
+    add_dir(m_root);
+    if (m_dir_paths.empty()) {
+        LOG_ERROR("watch doc root %s failure, file cache disabled", m_root.c_str());
+        return false;
+    }
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, worker, this) != 0) {
+        return false;
+    }
+    pthread_detach(tid);
+    m_enabled = true;
+    return true;
+}
+
+void file_cache::add_dir(const std::string &dir)
+{
+    int wd = inotify_add_watch(m_inotify_fd, dir.c_str(), FILE_EVENTS | IN_ONLYDIR);
+    if (wd < 0) {
+        LOG_ERROR("inotify_add_watch %s failure: %s", dir.c_str(), strerror(errno));
+        return;
+    }
+    m_lock.wrlock();
+    m_dirs[wd] = dir;
+    m_dir_paths.insert(dir);
+    m_lock.unlock();
+
+    // 子目录也要监视，符号链接的目录不跟随，经过它的路径不会被缓存
+    DIR *d = opendir(dir.c_str());
+    if (!d) {
+        return;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+        std::string sub = dir + "/" + ent->d_name;
+        bool is_dir = ent->d_type == DT_DIR;
+        // 有的文件系统不填d_type
+        if (ent->d_type == DT_UNKNOWN) {
+            struct stat st;
+            is_dir = lstat(sub.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+        }
+        if (is_dir) {
+            add_dir(sub);
+        }
+    }
+    closedir(d);
+}
+
+void file_cache::rebuild()
+{
+    m_lock.wrlock();
+    for (auto &it : m_dirs) {
+        inotify_rm_watch(m_inotify_fd, it.first);
+    }
+    m_dirs.clear();
+    m_dir_paths.clear();
+    m_files.clear();
+    m_gen.fetch_add(1);
+    m_lock.unlock();
+    add_dir(m_root);
+}
+
+SPFile file_cache::get(const char *path)
+{
+    SPFile file;
+    if (m_enabled) {
+        m_lock.rdlock();
+        auto it = m_files.find(path);
+        if (it != m_files.end()) {
+            file = it->second;
+        }
+        m_lock.unlock();
+    }
+    if (file) {
+        m_hits.fetch_add(1, std::memory_order_relaxed);
+    }
+    else {
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+    }
+    return file;
+}
+
+bool file_cache::cacheable(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    if (!slash || slash == path) {
+        return false;
+    }
+    const char *name = slash + 1;
+    if (name[0] == '\0' || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        return false;
+    }
+    std::string dir(path, slash - path);
+    m_lock.rdlock();
+    bool watched = m_dir_paths.count(dir) > 0;
+    m_lock.unlock();
+    return watched;
+}
+
+SPFile file_cache::load(const char *path, const struct stat &st)
+{
+    // 先记下失效计数，打开文件之后如果有失效事件，打开的可能是旧文件，不放入缓存
+    unsigned long gen = m_gen.load();
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return SPFile();
+    }
+    SPFile file = std::make_shared<cached_file>();
+    file->fd = fd;
+    // 大小和修改时间以打开的文件为准，调用者的stat只用来检查权限
+    struct stat fst;
+    if (fstat(fd, &fst) < 0) {
+        fst = st;
+    }
+    file->size = fst.st_size;
+    file->mtime = fst.st_mtime;
+    file->mtime_ns = fst.st_mtim.tv_nsec;
+    file->ino = fst.st_ino;
+    if (m_map && file->size > 0) {
+        void *addr = mmap(0, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            return SPFile();
+        }
+        file->addr = (char *)addr;
+    }
+
+    if (!m_enabled || !cacheable(path)) {
+        return file;
+    }
+    // 文件本身是符号链接时，链接目标的变化收不到通知
+    struct stat lst;
+    if (lstat(path, &lst) < 0 || S_ISLNK(lst.st_mode)) {
+        return file;
+    }
+    m_lock.wrlock();
+    if (m_gen.load() == gen && m_files.size() < FILE_CACHE_SIZE) {
+        file->cached = true;
+        m_files[path] = file;
+    }
+    m_lock.unlock();
+    return file;
+}
+
+void file_cache::invalidate(const std::string &path)
+{
+    m_lock.wrlock();
+    m_files.erase(path);
+    m_gen.fetch_add(1);
+    m_lock.unlock();
+}
+
+void file_cache::clear()
+{
+    m_lock.wrlock();
+    m_files.clear();
+    m_gen.fetch_add(1);
+    m_lock.unlock();
+}
+
+void *file_cache::worker(void *arg)
+{
+    file_cache *cache = (file_cache *)arg;
+    cache->run();
+    return nullptr;
+}
+
+void file_cache::run()
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (true) {
+        ssize_t n = read(m_inotify_fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            LOG_ERROR("inotify read failure, file cache disabled");
+            m_enabled = false;
+            clear();
+            return;
+        }
+        for (char *p = buf; p < buf + n; ) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + ev->len;
+
+            // 事件队列溢出，丢失了事件，不知道哪些文件变了
+            if (ev->mask & IN_Q_OVERFLOW) {
+                clear();
+                continue;
+            }
+            m_lock.rdlock();
+            auto it = m_dirs.find(ev->wd);
+            std::string dir = it != m_dirs.end() ? it->second : std::string();
+            m_lock.unlock();
+            // 已经移除的监视(重新监视之前的)，忽略
+            if (dir.empty()) {
+                continue;
+            }
+            // 目录本身或者子目录被创建、删除、改名，目录和路径的对应关系变了，全部重来
+            if ((ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) || (ev->mask & IN_ISDIR)) {
+                LOG_INFO("directory under %s changed, rebuild file cache", dir.c_str());
+                rebuild();
+                continue;
+            }
+            if (ev->len > 0) {
+                invalidate(dir + "/" + ev->name);
+            }
+        }
+    }
+}
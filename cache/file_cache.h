@@ -0,0 +1,97 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
+#include "../lock/locker.h"
+
+#define FILE_CACHE_SIZE 4096   // 最多缓存的文件个数，满了以后新文件不再加入缓存
+
+// 打开的文件，创建后不再修改，多个连接共享，最后一个引用释放时关闭fd、解除映射
+struct cached_file {
+    int fd;
+    off_t size;
+    time_t mtime;
+    long mtime_ns;  // 修改时间的纳秒部分，同一秒内的修改也能生成不同的ETag
+    ino_t ino;
+    char *addr;     // 整个文件的只读映射，sendfile模式或者空文件时为空
+    bool cached;    // 是否放入了文件缓存，没放入的每次请求都是新对象
+
+    cached_file() : fd(-1), size(0), mtime(0), mtime_ns(0), ino(0), addr(nullptr), cached(false) {}
+    ~cached_file();
+};
+
+using SPFile = std::shared_ptr<cached_file>;
+
+#define ETAG_LEN 64     // ETag字符串的缓冲区大小
+#define HTTP_DATE_LEN 32
+
+// 由inode、大小和修改时间生成强ETag(带双引号)，gzip压缩的响应是另一个表示，加上"-gz"
+int make_etag(char *buf, int len, ino_t ino, off_t size, time_t mtime, long mtime_ns, bool gzip);
+// HTTP日期，如"Sun, 06 Nov 1994 08:49:37 GMT"，用于Last-Modified
+int http_date(char *buf, int len, time_t t);
+// 解析HTTP日期，格式不对时返回-1
+time_t parse_http_date(const char *str);
+
+/*
+    网站根目录的文件缓存，按完整路径保存打开的fd、大小、修改时间和映射
+    1.命中时只是一次哈希查找，没有stat/open/mmap系统调用
+    2.读写锁保护，所有反应堆和工作线程并发查找；没命中时在锁外打开文件，再加写锁放入
+    3.inotify监视根目录和所有子目录，文件修改、删除、改名、权限变化时删除对应的项，
+      正在发送的响应持有引用，旧的fd和映射在发送完后才释放
+    4.只缓存直接位于被监视目录中、不是符号链接的文件，路径中有"//"、".."或经过符号链接目录时不缓存，
+      保证缓存中的每个文件都能收到失效通知
+    inotify不可用时不启用缓存，每次请求都打开文件
+*/
+class file_cache
+{
+public:
+    // 单例模式
+    static file_cache *GetInstance() {
+        static file_cache cache;
+        return &cache;
+    }
+
+    // 监视网站根目录，map_files为true时文件映射到内存，为false时只保留fd(sendfile)
+    bool init(const char *root, bool map_files);
+    // 查找缓存，没有时返回空
+    SPFile get(const char *path);
+    // 打开文件，能缓存时放入缓存，st是调用者已经检查过的stat结果，打开失败返回空
+    SPFile load(const char *path, const struct stat &st);
+
+    long hits() const { return m_hits.load(std::memory_order_relaxed); }
+    long misses() const { return m_misses.load(std::memory_order_relaxed); }
+
+private:
+    file_cache();
+    ~file_cache();
+
+    static void *worker(void *arg);
+    void run();                                 // inotify线程，读取事件并删除失效的项
+    void add_dir(const std::string &dir);       // 监视一个目录和它下面的所有子目录
+    void rebuild();                             // 目录结构变化，清空缓存，重新监视整个根目录
+    bool cacheable(const char *path);           // 文件是否直接位于被监视的目录中
+    void invalidate(const std::string &path);   // 删除一项
+    void clear();                               // 删除所有项
+
+private:
+    rwlocker m_lock;
+    std::unordered_map<std::string, SPFile> m_files;
+    std::unordered_map<int, std::string> m_dirs;    // inotify监视描述符 -> 目录
+    std::unordered_set<std::string> m_dir_paths;    // 被监视的目录
+    std::string m_root;
+    std::atomic<unsigned long> m_gen;               // 每次失效加1，打开文件期间有失效时不放入缓存
+    int m_inotify_fd;
+    std::atomic<bool> m_enabled;    // inotify线程出错时关闭缓存
+    bool m_map;
+    std::atomic<long> m_hits;
+    std::atomic<long> m_misses;
+};
+
+#endif
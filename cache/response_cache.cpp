@@ -0,0 +1,203 @@
+#include "response_cache.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+
+response_cache::response_cache() : m_bytes(0), m_threshold(0), m_gzip(true), m_hits(0), m_misses(0), m_evictions(0)
+{
+}
+
+// 扩展名对应的Content-Type，以及是不是值得压缩的文本
+struct file_type {
+    const char *ext;
+    const char *type;
+    bool text;
+};
+
+static const file_type file_types[] = {
+    { ".html", "text/html; charset=utf-8", true },
+    { ".htm", "text/html; charset=utf-8", true },
+    { ".css", "text/css; charset=utf-8", true },
+    { ".js", "application/javascript; charset=utf-8", true },
+    { ".txt", "text/plain; charset=utf-8", true },
+    { ".xml", "application/xml; charset=utf-8", true },
+    { ".json", "application/json; charset=utf-8", true },
+    { ".svg", "image/svg+xml", true },
+    { ".jpg", "image/jpeg", false },
+    { ".jpeg", "image/jpeg", false },
+    { ".png", "image/png", false },
+    { ".gif", "image/gif", false },
+    { ".ico", "image/x-icon", false },
+    { ".webp", "image/webp", false },
+    { ".mp4", "video/mp4", false },
+    { ".pdf", "application/pdf", false },
+    { ".woff2", "font/woff2", false },
+};
+
+static const file_type *find_type(const char *path)
+{
+    const char *dot = strrchr(path, '.');
+    if (!dot || strchr(dot, '/')) {
+        return nullptr;
+    }
+    for (const file_type &t : file_types) {
+        if (strcasecmp(dot, t.ext) == 0) {
+            return &t;
+        }
+    }
+    return nullptr;
+}
+
+bool response_cache::compressible(const char *path)
+{
+    const file_type *t = find_type(path);
+    return t && t->text;
+}
+
+const char *response_cache::content_type(const char *path)
+{
+    const file_type *t = find_type(path);
+    return t ? t->type : "application/octet-stream";
+}
+
+// 整个body一次压缩成gzip格式，输出不比输入小时返回false
+static bool gzip_compress(const char *data, size_t len, int level, std::string &out)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    // windowBits加16输出gzip头和尾，而不是zlib格式
+    if (deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    out.resize(deflateBound(&zs, len));
+    zs.next_in = (Bytef *)data;
+    zs.avail_in = len;
+    zs.next_out = (Bytef *)&out[0];
+    zs.avail_out = out.size();
+    int ret = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return ret == Z_STREAM_END && out.size() < len;
+}
+
+// 两个指针指向同一个对象(同一个控制块)，weak_ptr过期了也能比较，控制块在weak_ptr释放前不会被复用
+static bool same_file(const std::weak_ptr<cached_file> &a, const SPFile &b)
+{
+    return !a.owner_before(b) && !b.owner_before(a);
+}
+
+SPResponse response_cache::get(const char *path, const SPFile &file, bool gzip)
+{
+    // 压缩的响应在路径后面加上'\0'和编码名作为键，路径中不会有'\0'
+    std::string key(path);
+    if (gzip) {
+        key.push_back('\0');
+        key += "gzip";
+    }
+    m_lock.lock();
+    auto it = m_map.find(key);
+    if (it != m_map.end() && same_file(it->second.resp->file, file)) {
+        // 移到链表头
+        m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+        SPResponse resp = it->second.resp;
+        m_lock.unlock();
+        m_hits.fetch_add(1, std::memory_order_relaxed);
+        return resp;
+    }
+    m_lock.unlock();
+    m_misses.fetch_add(1, std::memory_order_relaxed);
+
+    // 在锁外读文件、拼响应
+    // 缓存的响应只压缩一次，用最高的压缩级别
+    SPResponse resp = build(path, file, gzip, Z_BEST_COMPRESSION);
+    if (!resp) {
+        return resp;
+    }
+
+    m_lock.lock();
+    it = m_map.find(key);
+    if (it != m_map.end()) {
+        // 过期的响应，换成新的
+        m_bytes -= it->second.resp->data.size();
+        it->second.resp = resp;
+        m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+    }
+    else {
+        m_lru.push_front(key);
+        entry e = { resp, m_lru.begin() };
+        m_map.emplace(key, e);
+    }
+    m_bytes += resp->data.size();
+    evict();
+    m_lock.unlock();
+    return resp;
+}
+
+SPResponse response_cache::make(const char *path, const SPFile &file, bool gzip)
+{
+    return build(path, file, gzip, Z_DEFAULT_COMPRESSION);
+}
+
+SPResponse response_cache::build(const char *path, const SPFile &file, bool gzip, int level)
+{
+    const char *body = file->addr;
+    std::string content;
+    if (!body) {
+        // sendfile模式下文件没有映射，用pread读，不改变共享fd的偏移
+        content.resize(file->size);
+        off_t off = 0;
+        while (off < file->size) {
+            ssize_t n = pread(file->fd, &content[off], file->size - off, off);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return SPResponse();
+            }
+            off += n;
+        }
+        body = content.data();
+    }
+    size_t body_len = file->size;
+
+    std::string compressed;
+    const char *encoding = "";
+    if (gzip && gzip_compress(body, body_len, level, compressed)) {
+        body = compressed.data();
+        body_len = compressed.size();
+        encoding = "Content-Encoding: gzip\r\n";
+    }
+    const char *vary = compressible(path) ? "Vary: Accept-Encoding\r\n" : "";
+    // 范围请求只针对未压缩的表示
+    const char *ranges = *encoding == '\0' ? "Accept-Ranges: bytes\r\n" : "";
+    char etag[ETAG_LEN];
+    char date[HTTP_DATE_LEN];
+    // ETag按协商的表示生成，压缩后没有变小时仍然带"-gz"，和304时由http_conn::want_gzip得出的ETag一致
+    make_etag(etag, sizeof(etag), file->ino, file->size, file->mtime, file->mtime_ns, gzip);
+    http_date(date, sizeof(date), file->mtime);
+
+    std::shared_ptr<cached_response> resp = std::make_shared<cached_response>();
+    char head[384];
+    int len = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Length: %ld\r\nContent-Type: %s\r\n%s%s"
+        "ETag: %s\r\nLast-Modified: %s\r\n%s", (long)body_len, content_type(path), encoding, vary, etag, date, ranges);
+    resp->data.reserve(len + body_len);
+    resp->data.append(head, len);
+    resp->data.append(body, body_len);
+    resp->head_len = len;
+    resp->file = file;
+    return resp;
+}
+
+void response_cache::evict()
+{
+    while (m_bytes > RESPONSE_CACHE_BYTES && !m_lru.empty()) {
+        auto it = m_map.find(m_lru.back());
+        m_bytes -= it->second.resp->data.size();
+        m_map.erase(it);
+        m_lru.pop_back();
+        m_evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+}
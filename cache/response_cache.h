@@ -0,0 +1,98 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include <string>
+#include <memory>
+#include <atomic>
+#include <list>
+#include <unordered_map>
+#include "../lock/locker.h"
+#include "file_cache.h"
+
+#define RESPONSE_CACHE_BYTES (16 << 20)    // 缓存的响应总大小上限，超过时淘汰最久没用的
+#define GZIP_MAX_SIZE (1 << 20)             // 压缩的文件大小上限，更大的文件不压缩
+
+/*
+    小文件的完整响应，创建后不再修改，多个连接共享
+    data中依次是响应行+Content-Length+Content-Type(+Content-Encoding+Vary)+ETag+Last-Modified(+Accept-Ranges)、消息体，
+    中间缺的Connection头由连接自己补上，发送时是三段iovec：head、Connection行(静态字符串)、body，一次writev
+*/
+struct cached_response {
+    std::string data;
+    int head_len;               // 响应头(不含Connection)的长度，后面紧跟消息体
+    std::weak_ptr<cached_file> file;  // 生成它的文件，文件缓存中的项失效后不再使用
+
+    const char *head() const { return data.data(); }
+    const char *body() const { return data.data() + head_len; }
+    int body_len() const { return (int)data.size() - head_len; }
+};
+
+using SPResponse = std::shared_ptr<const cached_response>;
+
+/*
+    小文件完整响应的缓存，按路径查找，LRU淘汰
+    1.命中时不再用vsnprintf格式化响应头，也不需要文件映射，响应直接从共享的缓冲区发送
+    2.只缓存文件缓存中的文件，响应记录生成它的cached_file，文件被inotify失效后文件缓存会换成新的对象，
+      这里比较不相等就重新生成，不需要单独监视文件
+    3.总大小超过RESPONSE_CACHE_BYTES时从链表尾部淘汰，一把互斥锁保护哈希表和LRU链表，临界区只有查找和移动链表节点
+    4.可以缓存的文件大小上限由set_threshold设置，0表示不使用，压缩的响应也受这个上限限制
+    5.文本类文件另外缓存gzip压缩后的响应，第一次请求时压缩一次，之后的请求不再消耗压缩的CPU，
+      和未压缩的响应按不同的键保存；压缩后没有变小时仍然保存未压缩的内容，ETag带"-gz"。这类文件的响应都带Vary: Accept-Encoding
+    6.超过上限的文本文件(不超过GZIP_MAX_SIZE)仍然可以压缩，由make在每个请求中生成，不进入缓存
+*/
+class response_cache
+{
+public:
+    // 单例模式
+    static response_cache *GetInstance() {
+        static response_cache cache;
+        return &cache;
+    }
+
+    // 小于等于bytes的文件缓存完整响应，0表示不缓存
+    void set_threshold(int bytes) { m_threshold = bytes; }
+    int threshold() const { return m_threshold; }
+    // 是否为文本类文件生成gzip压缩的响应
+    void set_gzip(bool on) { m_gzip = on; }
+    bool gzip() const { return m_gzip; }
+
+    // 取出path的响应，file是文件缓存中的当前文件，没有或者已经过期时生成一个新的并放入缓存
+    // gzip为true时取压缩的响应，调用者检查过客户端接受gzip并且文件可以压缩
+    SPResponse get(const char *path, const SPFile &file, bool gzip);
+    // 生成一个不放入缓存的响应，响应缓存关闭或者文件不能缓存时用，每个请求都要压缩一次，所以用较快的压缩级别
+    SPResponse make(const char *path, const SPFile &file, bool gzip);
+
+    // 按扩展名判断是不是值得压缩的文本文件，这类文件的响应要带Vary头
+    static bool compressible(const char *path);
+    // 按扩展名取Content-Type，不认识的扩展名为application/octet-stream
+    static const char *content_type(const char *path);
+
+    long hits() const { return m_hits.load(std::memory_order_relaxed); }
+    long misses() const { return m_misses.load(std::memory_order_relaxed); }
+    long evictions() const { return m_evictions.load(std::memory_order_relaxed); }
+
+private:
+    response_cache();
+    ~response_cache() {}
+
+    SPResponse build(const char *path, const SPFile &file, bool gzip, int level);   // 生成完整响应，读文件失败返回空
+    void evict();                           // 淘汰到总大小不超过上限，调用者持有锁
+
+    struct entry {
+        SPResponse resp;
+        std::list<std::string>::iterator lru;
+    };
+
+private:
+    locker m_lock;
+    std::unordered_map<std::string, entry> m_map;
+    std::list<std::string> m_lru;   // 链表头是最近使用的路径
+    size_t m_bytes;
+    int m_threshold;
+    bool m_gzip;
+    std::atomic<long> m_hits;
+    std::atomic<long> m_misses;
+    std::atomic<long> m_evictions;
+};
+
+#endif
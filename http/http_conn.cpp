@@ -1,7 +1,11 @@
+#define LOG_MODULE LOG_HTTP
 #include "http_conn.h"
 
 // 定义HTTP响应的一些状态信息
 const char* ok_200_title = "OK";
+const char* partial_206_title = "Partial Content";
+const char* not_modified_304_title = "Not Modified";
+const char* error_416_title = "Range Not Satisfiable";
 const char* error_400_title = "Bad Request";
 const char* error_400_form = "Your request has bad syntax or is inherently impossible to satisfy.\n";
 const char* error_403_title = "Forbidden";
@@ -10,15 +14,27 @@ const char* error_404_title = "Not Found";
 const char* error_404_form = "The requested file was not found on this server.\n";
 const char* error_500_title = "Internal Error";
 const char* error_500_form = "There was an unusual problem serving the requested file.\n";
+// 过载时的应答，预先拼好，反应堆线程直接发送，不经过解析和写缓冲区
+static const char busy_503_response[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Retry-After: 1\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n\r\n";
+// 缓存的完整响应中缺少的Connection头
+static const char keep_alive_line[] = "Connection: keep-alive\r\n\r\n";
+static const char close_line[] = "Connection: close\r\n\r\n";
+// 访问日志中的请求方法，和METHOD的顺序一致
+static const char *method_names[] = { "GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT" };
 
 // 初始化静态成员变量
-int http_conn::m_user_count = 0;
-int http_conn::m_epollfd = -1;
+std::atomic<int> http_conn::m_user_count(0);
 const char *http_conn::doc_root = {};
+bool http_conn::m_sendfile = false;
+int http_conn::m_access_sample = 0;
+int http_conn::m_access_error_sample = 0;
 sql_conn_pool *http_conn::m_connPool = nullptr;
 map<string, string> http_conn::user_table={};
 locker http_conn::m_lock=locker();
-std::unique_ptr<SPHttp[]> http_conn::users=nullptr;
 
 // 初始化数据库数据到本地
 void http_conn::initmysql_table()
@@ -31,9 +47,9 @@ void http_conn::initmysql_table()
     // 在user表中检索username，passwd数据，浏览器端输入
     if (mysql_query(mysql, "SELECT username,passwd FROM user"))
     {
-        LOG_ERROR("MySQL SELECT error:%s", mysql_error(mysql));
+        LOG_TO(LOG_SQL, LOG_LEVEL_ERROR, "MySQL SELECT error:%s", mysql_error(mysql));
     }
-    LOG_INFO("Get the MySQL table success!");
+    LOG_TO(LOG_SQL, LOG_LEVEL_INFO, "Get the MySQL table success!");
     // 从表中检索完整的结果集
     MYSQL_RES *result = mysql_store_result(mysql);
     // // 结果集列数
@@ -105,33 +121,50 @@ void modfd(int epollfd, int fd, int ev) {
 // 释放连接对象，清理数组空间，同时定时器也同时被删除
 void http_conn::release_conn()
 {
-    LOG_INFO("Release client(%s) cfd(%d)connection and its timer......",inet_ntoa(m_address.sin_addr), m_sockfd);
-    
+    LOG_DEBUG("Release client(%s) cfd(%d)connection and its timer......",inet_ntoa(m_address.sin_addr), m_sockfd);
+
+    // 容忍时间已过，工作线程不会再访问这个连接，缓冲块还给缓冲块池，释放响应没发完时引用的文件
+    release_files();
+    m_read_buf.release();
+    m_write_buf.release();
+    m_scratch.release();
+
     if(users[m_sockfd])
         users[m_sockfd].reset(); // 引用计数减为0，释放资源
 }
 // 断开连接+标记删除+更新容忍时间
 void http_conn::close_conn() 
 {
-    removefd(m_epollfd, m_sockfd);// 先断开连接
+    m_poller->remove(m_sockfd);// 先断开连接
     m_user_count--; // 关闭一个连接，将客户总数量-1
+    // 线程池模式下工作线程可能还在解析或者写这个连接，缓冲块和文件引用不能在这里释放，
+    // 等容忍时间过后在release_conn()中释放
 
     // 统一标记删除，更新容忍时间2*TIMESHOT
-    timer.lock()->setdeleted();
-    timer.lock()->upadte(2 * TIMESLOT);
+    timer.setdeleted();
+    timer.upadte(2 * TIMESLOT);
+}
+
+// 服务器过载，直接回复503并关闭连接，只发一次，发不完也不等待
+void http_conn::reject_busy()
+{
+    send(m_sockfd, busy_503_response, sizeof(busy_503_response) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+    close_conn();
 }
 
 // 初始化连接,外部调用初始化套接字地址
-void http_conn::init(int sockfd, const sockaddr_in& addr)
+void http_conn::init(int sockfd, const sockaddr_in& addr, poller *poll, SPHttp *users)
 {
 
     m_sockfd = sockfd;
     m_address = addr;
+    m_poller = poll;
+    this->users = users;
     
     // 端口复用
     int reuse = 1;
     setsockopt( m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof( reuse ) );
-    addfd( m_epollfd, m_sockfd, true );
+    m_poller->add_conn( m_sockfd );
     m_user_count++;
     init();
 }
@@ -142,6 +175,26 @@ void http_conn::init()
     bytes_to_send = 0;
     bytes_have_send = 0;
 
+    m_read_buf.release();
+    m_write_buf.release();
+    m_scratch.release();
+    m_checked.blk = nullptr;
+    m_checked.off = 0;
+    m_line = nullptr;
+    m_more = false;
+    m_keep_alive = false;
+    m_iv_count = 0;
+    m_iv_head = 0;
+    m_file_count = 0;
+    m_response_count = 0;
+    m_access_count = 0;
+    m_close = false;
+    init_request();
+}
+
+// 解析状态只和一个请求有关，读缓冲区中的数据保留，同一次读到的后续请求接着解析
+void http_conn::init_request()
+{
     m_check_state = CHECK_STATE_REQUESTLINE;    // 初始状态为检查请求行
     m_linger = false;       // 默认不保持链接  Connection : keep-alive保持连接
 
@@ -150,27 +203,60 @@ void http_conn::init()
     m_version = 0;
     m_content_length = 0;
     m_host = 0;
-    m_start_line = 0;
-    m_checked_idx = 0;
-    m_read_idx = 0;
-    m_write_idx = 0;
+    m_accept_encoding = 0;
+    m_if_none_match = 0;
+    m_if_modified_since = 0;
+    m_range = 0;
+    m_if_range = 0;
+    m_range_count = 0;
+    m_cookie = 0;
     cgi = 0;
-    bzero(m_read_buf, READ_BUFFER_SIZE);
-    bzero(m_write_buf, WRITE_BUFFER_SIZE);
-    bzero(m_real_file, FILENAME_LEN);
+    m_real_file = nullptr;
+
+    // 上一个请求的数据不再需要，前面的整块归还
+    m_read_buf.normalize(m_checked);
+    m_start_line = m_req_start = m_checked;
+    m_line_len = 0;
+    m_colon = m_line_colon = -1;
+    m_read_buf.consume(m_req_start);
+    m_scratch.clear();
+}
+
+// 一批响应发送完毕，保持连接时调用
+void http_conn::init_response()
+{
+    bytes_to_send = 0;
+    bytes_have_send = 0;
+    m_write_buf.release();
+    m_iv_count = 0;
+    m_iv_head = 0;
+
+    // 读缓冲区中的数据都处理完了，所有块还给缓冲块池，空闲的长连接不占缓冲区，下次有数据到达时再取
+    // 还有剩余数据(下一个请求或者它的一部分)时数据不动，已经解析出的指针仍然有效
+    if ( m_read_buf.bytes_from(m_req_start) == 0 ) {
+        m_read_buf.release();
+        m_scratch.release();
+        m_checked.blk = nullptr;
+        m_checked.off = 0;
+        m_start_line = m_req_start = m_checked;
+    }
 }
 
 // 循环读取客户数据，直到无数据可读或者对方关闭连接
 bool http_conn::read() {
 
-    if( m_read_idx >= READ_BUFFER_SIZE ) {
+    if( m_read_buf.size() >= MAX_REQUEST_SIZE ) {
         return false;
     }
-    int bytes_read = 0;
-    //printf("初始m_read_idx：%d\n",m_read_idx);
+    ssize_t bytes_read = 0;
     while(true) {
-        // 从m_read_buf + m_read_idx索引出开始保存数据，大小是READ_BUFFER_SIZE - m_read_idx
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx,READ_BUFFER_SIZE - m_read_idx, 0 );
+        // 缓存的数据达到上限，剩下的数据留在内核中，处理完已经读到的流水线请求后再读
+        int room = MAX_REQUEST_SIZE - m_read_buf.size();
+        if( room <= 0 ) {
+            break;
+        }
+        // 读到尾块的剩余空间，放不下时追加新块
+        bytes_read = m_read_buf.read_fd( m_sockfd, room );
         if (bytes_read == -1) {
             if( errno == EAGAIN || errno == EWOULDBLOCK ) {
                 // 没有数据
@@ -180,39 +266,127 @@ bool http_conn::read() {
         } else if (bytes_read == 0) {   // 对方关闭连接
             return false;
         }
-        m_read_idx += bytes_read;
     }
 
     return true;
 }
 
+// 数据已经由poller读到缓冲区中(io_uring)，拷贝到读缓冲区，len<=0表示对方关闭或出错
+bool http_conn::read_from(const char *data, int len) {
+
+    if( len <= 0 || m_read_buf.size() >= MAX_REQUEST_SIZE ) {
+        return false;
+    }
+    m_read_buf.append( data, len );
+    return true;
+}
+
 // 解析一行，判断依据\r\n
-// TODO:这里可以用正则表达式优化
+// 读缓冲区是块链表，一行可能跨块，'\r'和'\n'也可能分别在两个块中
+// 块内用http_scan一次扫描16/32字节，找行尾的同时记下第一个':'的位置
 http_conn::LINE_STATUS http_conn::parse_line() {
-    char temp;
-    for ( ; m_checked_idx < m_read_idx; ++m_checked_idx ) {
-        temp = m_read_buf[ m_checked_idx ];
-        if ( temp == '\r' ) {
-            if ( ( m_checked_idx + 1 ) == m_read_idx ) {
-                return LINE_OPEN;
-            } else if ( m_read_buf[ m_checked_idx + 1 ] == '\n' ) {
-                m_read_buf[ m_checked_idx++ ] = '\0';
-                m_read_buf[ m_checked_idx++ ] = '\0';
-                return LINE_OK;
+    m_read_buf.normalize( m_checked );
+    buffer_block *blk = m_checked.blk;
+    if ( !blk ) {
+        return LINE_OPEN;
+    }
+    int idx = m_checked.off;
+    while ( true ) {
+        // 当前块扫描完了，转到下一块
+        if ( idx >= blk->end ) {
+            if ( !blk->next ) {
+                break;
             }
-            return LINE_BAD;
-        } else if( temp == '\n' )  {
-            if( ( m_checked_idx > 1) && ( m_read_buf[ m_checked_idx - 1 ] == '\r' ) ) {
-                m_read_buf[ m_checked_idx-1 ] = '\0';
-                m_read_buf[ m_checked_idx++ ] = '\0';
-                return LINE_OK;
+            blk = blk->next;
+            idx = blk->begin;
+            continue;
+        }
+        int colon = -1;
+        int n = scan_line( blk->data() + idx, blk->end - idx, colon );
+        // 冒号的位置相对于行首，行跨块时接着上一块的长度计算
+        if ( m_colon < 0 && colon >= 0 ) {
+            m_colon = m_line_len + colon;
+        }
+        m_line_len += n;
+        idx += n;
+        if ( idx >= blk->end ) {
+            continue;
+        }
+        if ( blk->data()[ idx ] == '\r' ) {
+            buffer_block *nblk = blk;
+            int nidx = idx + 1;
+            if ( nidx >= blk->end && blk->next ) {
+                nblk = blk->next;
+                nidx = nblk->begin;
+            }
+            if ( nidx >= nblk->end ) {
+                // '\r'是最后一个字节，下次从'\r'开始重新判断
+                m_checked.blk = blk;
+                m_checked.off = idx;
+                return LINE_OPEN;
+            } else if ( nblk->data()[ nidx ] == '\n' ) {
+                return finish_line( blk, idx );
             }
             return LINE_BAD;
         }
+        // 前面没有'\r'的'\n'
+        return LINE_BAD;
     }
+    m_checked.blk = blk;
+    m_checked.off = idx;
     return LINE_OPEN;
 }
 
+// 一行在blk的idx处('\r')结束，后面紧跟'\n'
+http_conn::LINE_STATUS http_conn::finish_line( buffer_block *blk, int idx ) {
+    m_read_buf.normalize( m_start_line );
+    buffer_block *nblk = blk;   // '\n'所在的块
+    int nidx = idx + 1;
+    if ( nidx >= blk->end ) {
+        nblk = blk->next;
+        nidx = nblk->begin;
+    }
+
+    if ( m_start_line.blk == blk && nblk == blk ) {
+        // 整行在一个块内，和原来一样直接在读缓冲区中解析
+        blk->data()[ idx ] = '\0';
+        blk->data()[ idx + 1 ] = '\0';
+        m_line = blk->data() + m_start_line.off;
+    }
+    else {
+        // 行跨了块，拷贝到临时区，后面同样留两个'\0'，和在读缓冲区中解析时的布局一样
+        int len = 0;
+        for ( buffer_block *b = m_start_line.blk; ; b = b->next ) {
+            int from = b == m_start_line.blk ? m_start_line.off : b->begin;
+            int to = b == blk ? idx : b->end;
+            len += to - from;
+            if ( b == blk ) break;
+        }
+        if ( len + 2 > BUFFER_BLOCK_SIZE ) {
+            return LINE_BAD;
+        }
+        char *line = m_scratch.reserve( len + 2 );
+        char *p = line;
+        for ( buffer_block *b = m_start_line.blk; ; b = b->next ) {
+            int from = b == m_start_line.blk ? m_start_line.off : b->begin;
+            int to = b == blk ? idx : b->end;
+            memcpy( p, b->data() + from, to - from );
+            p += to - from;
+            if ( b == blk ) break;
+        }
+        p[ 0 ] = p[ 1 ] = '\0';
+        m_scratch.commit( len + 2 );
+        m_line = line;
+    }
+    m_checked.blk = nblk;
+    m_checked.off = nidx + 1;
+    // 下一行重新计数
+    m_line_colon = m_colon;
+    m_line_len = 0;
+    m_colon = -1;
+    return LINE_OK;
+}
+
 // 解析HTTP请求行，获得请求方法，目标URL,以及HTTP版本号
 http_conn::HTTP_CODE http_conn::parse_request_line(char* text) {
     // GET /index.html HTTP/1.1
@@ -270,7 +444,6 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text) {
 }
 
 // 解析HTTP请求的一个头部信息
-//TODO：这里可以支持更多的头部信息
 http_conn::HTTP_CODE http_conn::parse_headers(char* text) {   
     // 遇到空行，表示头部字段解析完毕
     if( text[0] == '\0' ) {
@@ -282,40 +455,78 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text) {
         }
         // 否则说明我们已经得到了一个完整的HTTP请求
         return GET_REQUEST;
-    } else if ( strncasecmp( text, "Connection:", 11 ) == 0 ) {
+    }
+    // 扫描行时已经找到了':'，字段名是它前面的部分
+    // 没有':'的头部行格式错误，客户端可以构造大量这样的行，只在DEBUG级别记录
+    if ( m_line_colon < 0 ) {
+        LOG_DEBUG("malformed header line %s", text);
+        return BAD_REQUEST;
+    }
+    char *value = text + m_line_colon + 1;
+    value += strspn( value, " \t" );
+
+    // 字段名查完美哈希表，一次比较就知道是哪个字段
+    switch ( lookup_header( text, m_line_colon ) ) {
+    case HDR_CONNECTION:
         // 处理Connection 头部字段  Connection: keep-alive
-        text += 11;
-        text += strspn( text, " \t" );
-        if ( strcasecmp( text, "keep-alive" ) == 0 ) {
+        if ( strcasecmp( value, "keep-alive" ) == 0 ) {
             m_linger = true;
         }
-    } else if ( strncasecmp( text, "Content-Length:", 15 ) == 0 ) {
+        break;
+    case HDR_CONTENT_LENGTH:
         // 处理Content-Length头部字段
-        text += 15;
-        text += strspn( text, " \t" );
-        m_content_length = atol(text);
-    } else if ( strncasecmp( text, "Host:", 5 ) == 0 ) {
+        m_content_length = atol(value);
+        if ( m_content_length < 0 || m_content_length > MAX_REQUEST_SIZE ) {
+            return BAD_REQUEST;
+        }
+        break;
+    case HDR_TRANSFER_ENCODING:
+        // 不支持分块传输的消息体，忽略它会把消息体当成下一个流水线请求
+        return BAD_REQUEST;
+    case HDR_HOST:
         // 处理Host头部字段
-        text += 5;
-        text += strspn( text, " \t" );
-        m_host = text;
-    }
-    else {
-        // 不认识该字段(该字段未被处理)
+        m_host = value;
+        break;
+    case HDR_ACCEPT_ENCODING:
+        m_accept_encoding = value;
+        break;
+    case HDR_IF_NONE_MATCH:
+        m_if_none_match = value;
+        break;
+    case HDR_IF_MODIFIED_SINCE:
+        m_if_modified_since = value;
+        break;
+    case HDR_RANGE:
+        m_range = value;
+        break;
+    case HDR_IF_RANGE:
+        m_if_range = value;
+        break;
+    case HDR_COOKIE:
+        m_cookie = value;
+        break;
+    case HDR_UNKNOWN:
+        // 不认识该字段(该字段未被处理)，浏览器的请求里很常见，只在debug级别记录
         //printf( "oop! unknow header %s\n", text );
-        LOG_INFO("oop! unknow header %s", text);
+        LOG_DEBUG("oop! unknow header %s", text);
+        break;
+    default:
+        // 认识但是不需要处理的字段
+        break;
     }
     return NO_REQUEST;
 }
 
 // 解析HTTP请求的消息体，只是判断它是否被完整的读入了
-http_conn::HTTP_CODE http_conn::parse_content( char* text ) {
-    if ( m_read_idx >= ( m_content_length + m_checked_idx ) )
+http_conn::HTTP_CODE http_conn::parse_content() {
+    if ( m_read_buf.bytes_from( m_checked ) >= m_content_length )
     {
-        text[ m_content_length ] = '\0';
         //POST请求中最后为输入的用户名和密码  user=root&password=root
-        std::string messages(text); // 转换为string类型
-        m_string = messages;
+        // 消息体可能跨块，按长度拷贝，不能在消息体后面写结束符，后面可能紧跟着下一个流水线请求
+        // 拷贝后m_checked跳过消息体，下一个请求从这里开始
+        m_string.clear();
+        m_read_buf.copy_out( m_checked, m_string, m_content_length );
+        m_start_line = m_checked;
         return GET_REQUEST;
     }
     return NO_REQUEST;
@@ -332,9 +543,9 @@ http_conn::HTTP_CODE http_conn::process_read()
         || ((line_status = parse_line()) == LINE_OK)) {
         // 获取一行数据
         text = get_line(); 
-        m_start_line = m_checked_idx;
+        m_start_line = m_checked;
         //printf( "got 1 http line: %s\n", text );
-        LOG_INFO("got 1 http line:%s", text);
+        LOG_DEBUG("got 1 http line:%s", text);
         switch (m_check_state)
         {
         case CHECK_STATE_REQUESTLINE:
@@ -356,29 +567,35 @@ http_conn::HTTP_CODE http_conn::process_read()
                 break;
             }
             case CHECK_STATE_CONTENT: {
-                ret = parse_content( text );
+                ret = parse_content();
                 if ( ret == GET_REQUEST ) {
                     return do_request();
                 }
-                line_status = LINE_OPEN;
-                break;
+                // 消息体不完整，不能再按行扫描消息体，m_checked要停在消息体开头
+                return NO_REQUEST;
             }
             default: {
                 return INTERNAL_ERROR;
             }
             }
     }
+    // 行格式错误或者一行超过了缓冲块大小
+    if ( line_status == LINE_BAD ) {
+        return BAD_REQUEST;
+    }
     return NO_REQUEST;
 }
 
 // 当得到一个完整、正确的HTTP请求时，我们就分析目标文件的属性，
-// 如果目标文件存在、对所有用户可读，且不是目录，则使用mmap将其
-// 映射到内存地址m_file_address处，并告诉调用者获取文件成功
+// 如果目标文件存在、对所有用户可读，且不是目录，则从文件缓存中取出它(fd和映射)，
+// 并告诉调用者获取文件成功
 http_conn::HTTP_CODE http_conn::do_request()
 {
     // "/home/young/workspace/stay_linux/WebServer/resources"
 
-    // 拼接成完整路径
+    // 拼接成完整路径，路径放在本请求的临时缓冲区中，请求结束随缓冲区一起归还
+    m_real_file = m_scratch.reserve( FILENAME_LEN );
+    m_scratch.commit( FILENAME_LEN );
     strcpy( m_real_file, doc_root );
     int len = strlen( doc_root );
     const char *p = strrchr(m_url, '/');
@@ -496,122 +713,437 @@ http_conn::HTTP_CODE http_conn::do_request()
     if (next_char>='0' && next_char<='7' && !urls[next_char-'0'].empty())
     {
         std::string m_url_real = urls[next_char - '0'];
-        strncpy(m_real_file + len, m_url_real.c_str(), m_url_real.length());
+        strncpy(m_real_file + len, m_url_real.c_str(), FILENAME_LEN - len - 1);
     }
     else{
         strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
     }
+    // 缓冲区不再清零，路径过长被截断时strncpy不会补'\0'
+    m_real_file[ FILENAME_LEN - 1 ] = '\0';
+
+    // 缓存命中：之前已经检查过权限，打开并映射好了，没有文件系统调用
+    file_cache *cache = file_cache::GetInstance();
+    m_file = cache->get( m_real_file );
+    if ( m_file ) {
+        if ( not_modified( m_file->ino, m_file->size, m_file->mtime, m_file->mtime_ns ) ) {
+            m_file.reset();
+            return NOT_MODIFIED;
+        }
+        return serve_file();
+    }
 
     // 获取m_real_file文件的相关的状态信息，-1失败，0成功
-    if ( stat( m_real_file, &m_file_stat ) < 0 ) {
+    struct stat file_stat;
+    if ( stat( m_real_file, &file_stat ) < 0 ) {
         return NO_RESOURCE;
     }
 
     // 判断访问权限
-    if ( ! ( m_file_stat.st_mode & S_IROTH ) ) {
+    if ( ! ( file_stat.st_mode & S_IROTH ) ) {
         return FORBIDDEN_REQUEST;
     }
 
     // 判断是否是目录
-    if ( S_ISDIR( m_file_stat.st_mode ) ) {
+    if ( S_ISDIR( file_stat.st_mode ) ) {
         return BAD_REQUEST;
     }
 
-    // 以只读方式打开文件
-    int fd = open( m_real_file, O_RDONLY );
-    // 创建内存映射
-    m_file_address = ( char* )mmap( 0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
-    close( fd );
+    // 客户端的缓存仍然有效时不打开文件
+    if ( not_modified( file_stat.st_ino, file_stat.st_size, file_stat.st_mtime, file_stat.st_mtim.tv_nsec ) ) {
+        return NOT_MODIFIED;
+    }
+
+    // 以只读方式打开文件，非sendfile模式下创建内存映射，能缓存时放入缓存
+    // sendfile模式只保留fd，发送时由内核直接从页缓存拷贝到套接字，不建立映射
+    m_file = cache->load( m_real_file, file_stat );
+    if ( !m_file ) {
+        return NO_RESOURCE;
+    }
+    return serve_file();
+}
+
+// 范围请求发送文件的一部分，不使用压缩和响应缓存；没有Range时小文件使用响应缓存
+http_conn::HTTP_CODE http_conn::serve_file() {
+    // 校验信息以打开的文件为准，stat之后文件可能变了
+    make_etag( m_etag, sizeof( m_etag ), m_file->ino, m_file->size, m_file->mtime, m_file->mtime_ns, false );
+    m_mtime = m_file->mtime;
+    m_range_count = parse_range( m_file->size );
+    if ( m_range_count < 0 ) {
+        return RANGE_NOT_SATISFIABLE;
+    }
+    if ( m_range_count == 0 ) {
+        use_response_cache();
+    }
     return FILE_REQUEST;
 }
 
-// 对内存映射区执行munmap操作
-void http_conn::unmap() {
-    if( m_file_address )
-    {
-        munmap( m_file_address, m_file_stat.st_size );
-        m_file_address= nullptr;
+// If-Range是ETag时必须和当前文件的ETag完全相同(强比较，弱ETag不匹配)，是日期时必须等于Last-Modified
+bool http_conn::if_range_match() {
+    if ( m_if_range[0] == '"' || strncmp( m_if_range, "W/", 2 ) == 0 ) {
+        return strcmp( m_if_range, m_etag ) == 0;
     }
+    return parse_http_date( m_if_range ) == m_mtime;
+}
+
+// 解析"bytes=0-99, 200-, -50"格式的Range头，返回范围个数，按起始位置排序并合并重叠和相邻的范围
+// 返回0表示忽略Range发送整个文件：不是GET、格式不对、If-Range不匹配、范围太多；返回-1表示所有范围都在文件外
+int http_conn::parse_range( off_t size ) {
+    if ( !m_range || m_method != GET || size == 0 ) {
+        return 0;
+    }
+    if ( m_if_range && !if_range_match() ) {
+        return 0;
+    }
+    if ( strncasecmp( m_range, "bytes=", 6 ) != 0 ) {
+        return 0;
+    }
+    byte_range specs[ 4 * MAX_RANGES ];
+    int count = 0;
+    bool seen = false;
+    const char *p = m_range + 6;
+    while ( *p ) {
+        p += strspn( p, " \t," );
+        if ( *p == '\0' ) {
+            break;
+        }
+        char *end;
+        off_t first, last;
+        if ( *p == '-' ) {
+            // 后缀范围，最后n个字节
+            if ( !isdigit( p[1] ) ) {
+                return 0;
+            }
+            off_t len = strtoll( p + 1, &end, 10 );
+            first = len >= size ? 0 : size - len;
+            last = len == 0 ? -1 : size - 1;
+        }
+        else {
+            if ( !isdigit( *p ) ) {
+                return 0;
+            }
+            first = strtoll( p, &end, 10 );
+            if ( *end != '-' ) {
+                return 0;
+            }
+            last = size - 1;
+            if ( isdigit( end[1] ) ) {
+                last = strtoll( end + 1, &end, 10 );
+                if ( last < first ) {
+                    return 0;
+                }
+                last = std::min( last, size - 1 );
+            }
+            else {
+                ++end;
+            }
+        }
+        p = end + strspn( end, " \t" );
+        if ( *p != '\0' && *p != ',' ) {
+            return 0;
+        }
+        seen = true;
+        // 起始位置在文件外的范围不能满足，忽略
+        if ( first > last || first >= size ) {
+            continue;
+        }
+        if ( count == 4 * MAX_RANGES ) {
+            return 0;
+        }
+        specs[ count ].first = first;
+        specs[ count ].last = last;
+        ++count;
+    }
+    if ( !seen ) {
+        return 0;
+    }
+    if ( count == 0 ) {
+        return -1;
+    }
+    std::sort( specs, specs + count, []( const byte_range &a, const byte_range &b ) { return a.first < b.first; } );
+    int merged = 0;
+    for ( int i = 0; i < count; ++i ) {
+        if ( merged > 0 && specs[i].first <= m_ranges[ merged - 1 ].last + 1 ) {
+            m_ranges[ merged - 1 ].last = std::max( m_ranges[ merged - 1 ].last, specs[i].last );
+            continue;
+        }
+        if ( merged == MAX_RANGES ) {
+            return 0;
+        }
+        m_ranges[ merged++ ] = specs[i];
+    }
+    return merged;
+}
+
+// If-None-Match中是否有和etag相同的项，格式如"\"a\", W/\"b\""或"*"，按弱比较忽略W/
+// 同一个文件的压缩和不压缩的表示内容相同，带不带"-gz"都算匹配
+static bool etag_match( const char *value, const char *etag ) {
+    size_t core = strlen( etag ) - 2;   // 去掉双引号
+    const char *p = value;
+    while ( *p ) {
+        p += strspn( p, " \t," );
+        if ( *p == '\0' ) {
+            break;
+        }
+        const char *tag = p;
+        size_t len = strcspn( p, ", \t" );
+        p += len;
+        if ( len == 1 && *tag == '*' ) {
+            return true;
+        }
+        if ( len > 2 && strncmp( tag, "W/", 2 ) == 0 ) {
+            tag += 2;
+            len -= 2;
+        }
+        if ( len < 2 || tag[0] != '"' || tag[len - 1] != '"' || strncmp( tag + 1, etag + 1, core ) != 0 ) {
+            continue;
+        }
+        if ( len == core + 2 || ( len == core + 5 && strncmp( tag + 1 + core, "-gz", 3 ) == 0 ) ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 生成目标文件的ETag，GET请求带条件时判断客户端缓存的是不是当前的文件
+// 有If-None-Match时只看它，没有时才看If-Modified-Since
+bool http_conn::not_modified( ino_t ino, off_t size, time_t mtime, long mtime_ns ) {
+    make_etag( m_etag, sizeof( m_etag ), ino, size, mtime, mtime_ns, false );
+    m_mtime = mtime;
+    if ( m_method != GET ) {
+        return false;
+    }
+    bool match = false;
+    if ( m_if_none_match ) {
+        match = etag_match( m_if_none_match, m_etag );
+    }
+    else if ( m_if_modified_since ) {
+        time_t since = parse_http_date( m_if_modified_since );
+        match = since != -1 && mtime <= since;
+    }
+    // 304带的ETag和200时发送的表示一致：200是否用压缩的表示也由want_gzip决定
+    if ( match && want_gzip( size ) ) {
+        make_etag( m_etag, sizeof( m_etag ), ino, size, mtime, mtime_ns, true );
+    }
+    return match;
+}
+
+// Accept-Encoding中是否接受gzip，格式如"gzip, deflate;q=0.5, *;q=0"
+// 明确列出gzip时看它的q值，没列出时看"*"，q=0表示不接受
+static bool accept_gzip( const char *value ) {
+    bool listed = false, gzip = false, star = false;
+    const char *p = value;
+    while ( *p ) {
+        p += strspn( p, " \t," );
+        if ( *p == '\0' ) {
+            break;
+        }
+        const char *name = p;
+        size_t len = strcspn( p, ";, \t" );
+        p += len;
+        double q = 1;
+        while ( *p && *p != ',' ) {
+            p += strspn( p, " \t;" );
+            if ( strncasecmp( p, "q=", 2 ) == 0 ) {
+                q = atof( p + 2 );
+            }
+            p += strcspn( p, ";," );
+        }
+        if ( ( len == 4 && strncasecmp( name, "gzip", 4 ) == 0 ) || ( len == 6 && strncasecmp( name, "x-gzip", 6 ) == 0 ) ) {
+            listed = true;
+            gzip = q > 0;
+        }
+        else if ( len == 1 && *name == '*' ) {
+            star = q > 0;
+        }
+    }
+    return listed ? gzip : star;
+}
+
+// 客户端接受gzip，文件是不太大的非空文本文件
+// 200时use_response_cache按它选择压缩的响应，304时按它选择ETag，两处必须用同一个判断
+bool http_conn::want_gzip( off_t size ) {
+    return response_cache::GetInstance()->gzip() && m_accept_encoding && size > 0 && size <= GZIP_MAX_SIZE
+        && response_cache::compressible( m_real_file ) && accept_gzip( m_accept_encoding );
+}
+
+// 文件缓存中不超过阈值的小文件使用响应缓存中的完整响应，发送时不再格式化响应头
+// 客户端接受gzip时，文本文件使用压缩过的响应：能缓存的只在第一次请求时压缩，其他的(包括-c 0)每个请求压缩一次
+void http_conn::use_response_cache() {
+    response_cache *responses = response_cache::GetInstance();
+    if ( m_file->size == 0 ) {
+        return;
+    }
+    bool gzip = want_gzip( m_file->size );
+    if ( m_file->cached && m_file->size <= responses->threshold() ) {
+        m_response = responses->get( m_real_file, m_file, gzip );
+    }
+    else if ( gzip ) {
+        m_response = responses->make( m_real_file, m_file, true );
+    }
+}
+
+// 释放本批响应引用的文件，缓存中的文件仍然打开，已经失效或者没有缓存的文件在最后一个引用释放时关闭
+void http_conn::release_files() {
+    m_file.reset();
+    for ( int i = 0; i < m_file_count; ++i ) {
+        m_files[i].reset();
+    }
+    m_file_count = 0;
+    m_response.reset();
+    for ( int i = 0; i < m_response_count; ++i ) {
+        m_responses[i].reset();
+    }
+    m_response_count = 0;
 }
 
 // 写HTTP响应
 bool http_conn::write()
 {
     int temp = 0;
-    
+
+    // 工作线程生成响应失败，在反应堆线程中关闭连接
+    if ( m_close ) {
+        return false;
+    }
     if ( bytes_to_send == 0 ) {
         // 将要发送的字节为0，这一次响应结束。
-        modfd( m_epollfd, m_sockfd, EPOLLIN ); 
-        init();
+        if ( !m_more ) {
+            m_poller->mod( m_sockfd, EPOLLIN ); 
+        }
+        init_response();
         return true;
     }
 
     while(1) {
-        // 分散写
-        temp = writev(m_sockfd, m_iv, m_iv_count);
+        if ( !m_iv[ m_iv_head ].iov_base ) {
+            // 文件：由内核从页缓存直接发送
+            temp = sendfile( m_sockfd, m_iv_file[ m_iv_head ].fd, &m_iv_file[ m_iv_head ].off, m_iv[ m_iv_head ].iov_len );
+        }
+        else {
+            // 分散写，到下一个文件为止；后面还有文件时带MSG_MORE，响应头和文件开头合并成满的TCP段
+            int end = m_iv_head;
+            while ( end < m_iv_count && m_iv[ end ].iov_base ) {
+                ++end;
+            }
+            struct msghdr msg;
+            memset( &msg, 0, sizeof( msg ) );
+            msg.msg_iov = m_iv + m_iv_head;
+            msg.msg_iovlen = end - m_iv_head;
+            temp = sendmsg( m_sockfd, &msg, MSG_NOSIGNAL | ( end < m_iv_count ? MSG_MORE : 0 ) );
+        }
         if ( temp < 0 ) {
             // 如果TCP写缓冲没有空间，则等待下一轮EPOLLOUT事件，虽然在此期间，
             // 服务器无法立即接收到同一客户的下一个请求，但可以保证连接的完整性。
             if( errno == EAGAIN ) {
-                modfd( m_epollfd, m_sockfd, EPOLLOUT );
+                m_poller->mod( m_sockfd, EPOLLOUT );
                 return true;
             }
-            unmap();
+            release_files();
+            return false;
+        }
+        // sendfile返回0说明文件在发送过程中被截断，剩下的长度永远发不完，关闭连接，不能一直重试
+        if ( temp == 0 && !m_iv[ m_iv_head ].iov_base ) {
+            release_files();
             return false;
         }
 
-        bytes_have_send += temp;
-        bytes_to_send -= temp;
+        int ret = advance(temp);
+        if (ret > 0) {
+            continue;
+        }
+        return ret == 0;
+    }
+}
+
+// 已经写出temp字节，调整iovec。返回1：还有数据要发送；0：发完了并保持连接；-1：发完了需要关闭连接
+// 同步写和io_uring异步写完成后都调用这里
+int http_conn::advance(int temp)
+{
+    bytes_have_send += temp;
+    bytes_to_send -= temp;
 
-        // 第一部分发完了
-        if (bytes_have_send >= m_iv[0].iov_len)
+    // 跳过已经发完的内存块，调整只发了一部分的那块
+    while (temp > 0 && m_iv_head < m_iv_count)
+    {
+        if ((size_t)temp >= m_iv[m_iv_head].iov_len)
         {
-            m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = bytes_to_send;
+            temp -= m_iv[m_iv_head].iov_len;
+            m_iv[m_iv_head].iov_len = 0;
+            ++m_iv_head;
         }
         else
         {
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - temp;
+            // sendfile已经更新了文件偏移，只需要调整剩下的长度
+            if (m_iv[m_iv_head].iov_base) {
+                m_iv[m_iv_head].iov_base = (char *)m_iv[m_iv_head].iov_base + temp;
+            }
+            m_iv[m_iv_head].iov_len -= temp;
+            temp = 0;
         }
+    }
 
-        //发完了，没有数据要发送了
-        if (bytes_to_send <= 0)
-        {
-            unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN);
+    //发完了，没有数据要发送了
+    if (bytes_to_send <= 0)
+    {
+        release_files();
+        if (m_access_count > 0) {
+            log_access();
+        }
 
-            if (m_linger)
-            {
-                init();
-                return true;
-            }
-            else
+        if (m_keep_alive)
+        {
+            init_response();
+            // 读缓冲区中还有流水线请求时由反应堆接着处理，不等读事件(数据已经读出来了，边沿触发不会再通知)
+            if (!m_more)
             {
-                return false;
+                m_poller->mod(m_sockfd, EPOLLIN);
             }
+            return 0;
         }
+        else
+        {
+            return -1;
+        }
+    }
+    return 1;
+}
+
+// 异步写(io_uring)：取出待发送的iovec，返回iovec的个数，0表示没有待发送的数据
+int http_conn::get_write_iov(struct iovec **iov)
+{
+    if ( m_close || bytes_to_send == 0 ) {
+        return 0;
     }
+    *iov = m_iv + m_iv_head;
+    return m_iv_count - m_iv_head;
 }
 
 // 往写缓冲中写入待发送的数据
+// 先写到尾块的剩余空间，放不下时换一个新块重新格式化，一次写入的内容不会跨块
 bool http_conn::add_response( const char* format, ... ) {
-    // 写满了
-    if( m_write_idx >= WRITE_BUFFER_SIZE )
-        return false;
     va_list arg_list;             // 可变参数列表
-    va_start( arg_list, format ); // 初始化参数列表
-    // vsnprintf 将格式化后的字符串写入到指定的缓冲区中
-    int len = vsnprintf( m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list );
-    if( len >= ( WRITE_BUFFER_SIZE - 1 - m_write_idx ) ) {
-        return false;
+    for ( int i = 0; i < 2; ++i ) {
+        int space = m_write_buf.tail_space();
+        if ( space <= 0 ) {
+            m_write_buf.reserve( BUFFER_BLOCK_SIZE );
+            continue;
+        }
+        va_start( arg_list, format ); // 初始化参数列表
+        // vsnprintf 将格式化后的字符串写入到指定的缓冲区中
+        int len = vsnprintf( m_write_buf.tail_ptr(), space, format, arg_list );
+        va_end( arg_list );
+        if ( len < 0 || len >= BUFFER_BLOCK_SIZE ) {
+            return false;
+        }
+        if ( len < space ) {
+            m_write_buf.commit( len );
+            return true;
+        }
+        m_write_buf.reserve( len + 1 );
     }
-    m_write_idx += len;
-    va_end( arg_list );
     // LOG_INFO("Request:%s", m_write_buf);
     // printf("reques: %s\n", m_write_buf);
-    return true;
+    return false;
 }
 
 // 写响应行
@@ -619,21 +1151,36 @@ bool http_conn::add_status_line( int status, const char* title ) {
     return add_response( "%s %d %s\r\n", "HTTP/1.1", status, title );
 }
 
-// 写响应头
+// 写响应头，消息体是服务器生成的html
 bool http_conn::add_headers(int content_len) {
-    add_content_length(content_len);
-    add_content_type();
-    add_linger();
-    add_blank_line();
-    return true;
+    return add_content_length(content_len) && add_content_type("text/html")
+        && add_linger() && add_blank_line();
 }
 
 bool http_conn::add_content_length(int content_len) {
     return add_response( "Content-Length: %d\r\n", content_len );
 }
 
-bool http_conn::add_content_type() {
-    return add_response("Content-Type:%s\r\n", "text/html");
+// 文件的类型用response_cache::content_type()按扩展名取，和缓存的响应一致
+bool http_conn::add_content_type( const char* type ) {
+    return add_response("Content-Type: %s\r\n", type);
+}
+
+bool http_conn::add_vary()
+{
+    return add_response( "%s", "Vary: Accept-Encoding\r\n" );
+}
+
+bool http_conn::add_validators()
+{
+    char date[HTTP_DATE_LEN];
+    http_date( date, sizeof( date ), m_mtime );
+    return add_response( "ETag: %s\r\nLast-Modified: %s\r\n", m_etag, date );
+}
+
+bool http_conn::add_accept_ranges()
+{
+    return add_response( "%s", "Accept-Ranges: bytes\r\n" );
 }
 
 bool http_conn::add_linger()
@@ -653,8 +1200,118 @@ bool http_conn::add_content( const char* content )
 }
 
 
+// 写缓冲区中从start开始的数据加入待发送的iovec，每个块一段
+void http_conn::add_write_iov( buffer_pos start )
+{
+    m_write_buf.normalize( start );
+    for ( buffer_block *blk = start.blk; blk; blk = blk->next ) {
+        int from = blk == start.blk ? start.off : blk->begin;
+        if ( blk->end > from ) {
+            add_iov( blk->data() + from, blk->end - from );
+        }
+    }
+}
+
+// 追加一段待发送的数据，和上一块在内存中相邻时直接合并
+void http_conn::add_iov( char *base, int len )
+{
+    if ( m_iv_count > 0 ) {
+        struct iovec &last = m_iv[ m_iv_count - 1 ];
+        if ( last.iov_base && (char *)last.iov_base + last.iov_len == base ) {
+            last.iov_len += len;
+            bytes_to_send += len;
+            return;
+        }
+    }
+    m_iv[ m_iv_count ].iov_base = base;
+    m_iv[ m_iv_count ].iov_len = len;
+    ++m_iv_count;
+    bytes_to_send += len;
+}
+
+// 追加一段由sendfile发送的文件，从off开始发送len字节
+void http_conn::add_file( int fd, off_t off, int len )
+{
+    m_iv[ m_iv_count ].iov_base = nullptr;
+    m_iv[ m_iv_count ].iov_len = len;
+    m_iv_file[ m_iv_count ].fd = fd;
+    m_iv_file[ m_iv_count ].off = off;
+    ++m_iv_count;
+    bytes_to_send += len;
+}
+
+void http_conn::add_file_range( off_t off, off_t len )
+{
+    if ( m_file->addr ) {
+        add_iov( m_file->addr + off, len );
+    }
+    else {
+        add_file( m_file->fd, off, len );
+    }
+}
+
+// 206响应，只发送请求的范围，文件内容仍然走映射或sendfile
+// 多个范围时是multipart/byteranges：每个范围前是分隔符和Content-Range，分段头在写缓冲区中，和文件段交替排列
+bool http_conn::add_ranges()
+{
+    buffer_pos start = m_write_buf.end_pos();
+    add_status_line( 206, partial_206_title );
+    bool vary = response_cache::compressible( m_real_file );
+    if ( m_range_count == 1 ) {
+        const byte_range &r = m_ranges[0];
+        if ( !add_content_length( r.last - r.first + 1 ) || !add_content_type( response_cache::content_type( m_real_file ) )
+             || !add_response( "Content-Range: bytes %ld-%ld/%ld\r\n", (long)r.first, (long)r.last, (long)m_file->size )
+             || ( vary && !add_vary() ) || !add_validators() || !add_accept_ranges()
+             || !add_linger() || !add_blank_line() ) {
+            return false;
+        }
+        add_write_iov( start );
+        add_file_range( r.first, r.last - r.first + 1 );
+        m_files[ m_file_count++ ] = std::move( m_file );
+        return true;
+    }
+
+    // 先拼好每个分段头，算出消息体的总长度
+    static thread_local unsigned int seed = time( NULL ) ^ (unsigned int)pthread_self();
+    char boundary[20];
+    snprintf( boundary, sizeof( boundary ), "%08x%08x", rand_r( &seed ), rand_r( &seed ) );
+    char parts[ MAX_RANGES ][ 192 ];
+    char tail[32];
+    long total = snprintf( tail, sizeof( tail ), "\r\n--%s--\r\n", boundary );
+    for ( int i = 0; i < m_range_count; ++i ) {
+        const byte_range &r = m_ranges[i];
+        total += snprintf( parts[i], sizeof( parts[i] ), "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %ld-%ld/%ld\r\n\r\n",
+            boundary, response_cache::content_type( m_real_file ), (long)r.first, (long)r.last, (long)m_file->size );
+        total += r.last - r.first + 1;
+    }
+    if ( !add_response( "Content-Length: %ld\r\nContent-Type: multipart/byteranges; boundary=%s\r\n", total, boundary )
+         || ( vary && !add_vary() ) || !add_validators() || !add_accept_ranges()
+         || !add_linger() || !add_blank_line() ) {
+        return false;
+    }
+    for ( int i = 0; i < m_range_count; ++i ) {
+        if ( i > 0 ) {
+            start = m_write_buf.end_pos();
+        }
+        if ( !add_response( "%s", parts[i] ) ) {
+            return false;
+        }
+        add_write_iov( start );
+        add_file_range( m_ranges[i].first, m_ranges[i].last - m_ranges[i].first + 1 );
+    }
+    start = m_write_buf.end_pos();
+    if ( !add_response( "%s", tail ) ) {
+        return false;
+    }
+    add_write_iov( start );
+    m_files[ m_file_count++ ] = std::move( m_file );
+    return true;
+}
+
 // 根据服务器处理HTTP请求的结果，决定返回给客户端的内容
+// 流水线请求的响应依次追加在写缓冲区和iovec后面
 bool http_conn::process_write(HTTP_CODE ret) {
+    buffer_pos start = m_write_buf.end_pos();   // 本响应的响应头在写缓冲区中的起始位置
     switch (ret)
     {
         case INTERNAL_ERROR:
@@ -665,6 +1322,8 @@ bool http_conn::process_write(HTTP_CODE ret) {
             }
             break;
         case BAD_REQUEST:
+            // 请求格式错误，无法确定它在哪里结束，后面的数据不再解析，发完关闭连接
+            m_linger = false;
             add_status_line( 400, error_400_title );
             add_headers( strlen( error_400_form ) );
             if ( ! add_content( error_400_form ) ) {
@@ -685,38 +1344,68 @@ bool http_conn::process_write(HTTP_CODE ret) {
                 return false;
             }
             break;
+        case NOT_MODIFIED:
+            // 304没有消息体，也不带Content-Length
+            add_status_line( 304, not_modified_304_title );
+            if ( ( response_cache::compressible( m_real_file ) && !add_vary() )
+                 || !add_validators() || !add_linger() || !add_blank_line() ) {
+                return false;
+            }
+            break;
+        case RANGE_NOT_SATISFIABLE:
+            add_status_line( 416, error_416_title );
+            if ( !add_response( "Content-Range: bytes */%ld\r\n", (long)m_file->size )
+                 || !add_content_length( 0 ) || !add_linger() || !add_blank_line() ) {
+                return false;
+            }
+            m_file.reset();
+            break;
         case FILE_REQUEST:
+            if ( m_range_count > 0 ) {
+                return add_ranges();
+            }
+            if ( m_response ) {
+                // 完整响应在共享的缓冲区中，只有Connection头因连接而不同，用静态字符串补上
+                const char *conn = m_linger ? keep_alive_line : close_line;
+                add_iov( (char *)m_response->head(), m_response->head_len );
+                add_iov( (char *)conn, strlen( conn ) );
+                add_iov( (char *)m_response->body(), m_response->body_len() );
+                m_responses[ m_response_count++ ] = std::move( m_response );
+                m_file.reset();
+                return true;
+            }
             add_status_line(200, ok_200_title );
             // 根据文件大小判断
             //如果请求的文件存在且大小不为 0，则将文件内容作为响应内容发送给客户端。
-            if (m_file_stat.st_size != 0)
+            if (m_file->size != 0)
             {
-                add_headers(m_file_stat.st_size);
-                m_iv[ 0 ].iov_base = m_write_buf;
-                m_iv[ 0 ].iov_len = m_write_idx;
-                m_iv[ 1 ].iov_base = m_file_address;
-                m_iv[ 1 ].iov_len = m_file_stat.st_size;
-                m_iv_count = 2;//响应消息和资源
-                // 将要发送的数据字节数，两部分相加
-                bytes_to_send = m_write_idx + m_file_stat.st_size;
-
+                // 文本文件的响应随Accept-Encoding变化，没有压缩时也要告诉缓存服务器
+                if ( !add_content_length( m_file->size ) || !add_content_type( response_cache::content_type( m_real_file ) )
+                     || ( response_cache::compressible( m_real_file ) && !add_vary() )
+                     || !add_validators() || !add_accept_ranges() || !add_linger() || !add_blank_line() ) {
+                    return false;
+                }
+                // 响应消息和资源，将要发送的数据字节数两部分相加
+                add_write_iov( start );
+                add_file_range( 0, m_file->size );
+                // 文件的引用交给本批响应统一释放
+                m_files[ m_file_count++ ] = std::move( m_file );
                 return true;
             }
             //如果请求的文件不存在或大小为 0，则发送一个空的 HTML 响应给客户端
             else{
+                m_file.reset();
                 const char *ok_string = "<html><body></body></html>";
                 add_headers(strlen(ok_string));
                 if (!add_content(ok_string))
                     return false;
             }
+            break;
         default:
             return false;
     }
     // 没有请求资源，只发送响应消息
-    m_iv[ 0 ].iov_base = m_write_buf;
-    m_iv[ 0 ].iov_len = m_write_idx;
-    m_iv_count = 1;
-    bytes_to_send = m_write_idx;
+    add_write_iov( start );
     return true;
 }
 
@@ -725,20 +1414,120 @@ bool http_conn::process_write(HTTP_CODE ret) {
 // 而线程池中的工作线程只负责对用户缓冲区内容进行请求解析同时生成响应
 
 // 由线程池中的工作线程调用，这是处理HTTP请求的入口函数
+// 支持HTTP/1.1流水线：一次读到的多个请求按顺序处理，响应合并后一次写出
 void http_conn::process() {
 
-    // 解析HTTP请求
-    HTTP_CODE read_ret = process_read();
-    if ( read_ret == NO_REQUEST ) {
-        modfd( m_epollfd, m_sockfd, EPOLLIN );
+    int count = 0;
+    m_more = false;
+    // 访问日志打开时记下开始处理的时间，排队时间和每个请求的处理时间都从这里算，关闭时不读时钟
+    bool access = m_access_sample > 0 || m_access_error_sample > 0;
+    time_p last;
+    int queue_us = 0;
+    if ( access ) {
+        last = Clock::now();
+        if ( queued_at != time_p() ) {
+            queue_us = std::chrono::duration_cast<std::chrono::microseconds>( last - queued_at ).count();
+        }
+    }
+    while ( true ) {
+        // 解析HTTP请求
+        HTTP_CODE read_ret = process_read();
+        if ( read_ret == NO_REQUEST ) {
+            break;
+        }
+
+        // 生成响应
+        // 失败时不能在这里close_conn()，工作线程不能操作反应堆的时间轮，
+        // 标记后仍然注册写事件，由反应堆线程在write()中发现并关闭连接
+        int before = bytes_to_send;
+        bool write_ret = process_write( read_ret );
+        ++count;
+        if ( !write_ret ) {
+            m_close = true;
+            LOG_ERROR("Write error in client(%s) cfd(%d)", inet_ntoa(m_address.sin_addr),m_sockfd);
+            break;
+        }
+        if ( access ) {
+            add_access( read_ret, bytes_to_send - before, queue_us, last );
+        }
+        m_keep_alive = m_linger;
+        init_request();
+
+        // 非长连接，发完就关闭，后面的请求不再处理
+        if ( !m_keep_alive ) {
+            break;
+        }
+        if ( m_read_buf.bytes_from( m_checked ) == 0 ) {
+            break;
+        }
+        // 一批最多处理MAX_PIPELINE个，iovec快用完时也停下，剩下的等这一批写完再处理
+        if ( count >= MAX_PIPELINE || m_iv_count + MAX_RESPONSE_IOV > MAX_IOV ) {
+            m_more = true;
+            break;
+        }
+    }
+
+    if ( count == 0 ) {
+        m_poller->mod( m_sockfd, EPOLLIN );
+        return;
+    }
+    m_ready_at = last;
+    m_poller->mod( m_sockfd, EPOLLOUT);
+}
+
+int http_conn::response_status( HTTP_CODE ret ) {
+    switch ( ret ) {
+        case INTERNAL_ERROR:
+            return 500;
+        case BAD_REQUEST:
+            return 400;
+        case NO_RESOURCE:
+            return 404;
+        case FORBIDDEN_REQUEST:
+            return 403;
+        case NOT_MODIFIED:
+            return 304;
+        case RANGE_NOT_SATISFIABLE:
+            return 416;
+        default:
+            return m_range_count > 0 ? 206 : 200;
+    }
+}
+
+// 每个线程分别对正常和出错的请求计数，每到采样间隔记一个；被采样的才复制路径
+void http_conn::add_access( HTTP_CODE ret, int bytes, int queue_us, time_p &last ) {
+    static thread_local int ok_count = 0;
+    static thread_local int error_count = 0;
+    time_p now = Clock::now();
+    int parse_us = std::chrono::duration_cast<std::chrono::microseconds>( now - last ).count();
+    last = now;
+
+    int status = response_status( ret );
+    int sample = status >= 400 ? m_access_error_sample : m_access_sample;
+    int &count = status >= 400 ? error_count : ok_count;
+    if ( sample <= 0 || ++count < sample ) {
         return;
     }
+    count = 0;
+    access_entry &e = m_access[ m_access_count++ ];
+    e.status = status;
+    e.method = m_method;
+    e.bytes = bytes;
+    e.queue_us = queue_us;
+    e.parse_us = parse_us;
+    snprintf( e.path, sizeof( e.path ), "%s", m_url ? m_url : "-" );
+}
 
-    // 生成响应
-    bool write_ret = process_write( read_ret );
-    if ( !write_ret ) {
-        close_conn();
-        LOG_ERROR("Write error in client(%s) cfd(%d)", inet_ntoa(m_address.sin_addr),m_sockfd);
+// 一行一个请求：时间 客户端 方法 路径 状态码 字节数 排队us 处理us 发送us
+void http_conn::log_access() {
+    int send_us = std::chrono::duration_cast<std::chrono::microseconds>( Clock::now() - m_ready_at ).count();
+    char client[INET_ADDRSTRLEN];
+    inet_ntop( AF_INET, &m_address.sin_addr, client, sizeof( client ) );
+    Log *log = Log::get_access();
+    for ( int i = 0; i < m_access_count; ++i ) {
+        const access_entry &e = m_access[i];
+        log->write_log( 1, "%s %s %s %d %d %d %d %d", client, method_names[ e.method ], e.path,
+                        e.status, e.bytes, e.queue_us, e.parse_us, send_us );
     }
-    modfd( m_epollfd, m_sockfd, EPOLLOUT);
+    m_access_count = 0;
 }
\ No newline at end of file
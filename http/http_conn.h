@@ -11,6 +11,8 @@
 #include <arpa/inet.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
 #include <fcntl.h>
 #include <stdarg.h>
 #include <errno.h>
@@ -21,11 +23,20 @@
 #include <map>
 #include <mysql/mysql.h>
 #include <fstream>
+#include <atomic>
+#include <memory>
+#include <algorithm>
 
 #include "../MySQL/sql_conn_pool.h"
 #include "../lock/locker.h"
 #include "../logs/log.h"
-#include "../Timer_lst/priorityTimer.h"
+#include "../Timer_lst/wheelTimer.h"
+#include "../reactor/poller.h"
+#include "../buffer/chain_buffer.h"
+#include "../cache/file_cache.h"
+#include "../cache/response_cache.h"
+#include "http_scan.h"
+#include "http_header.h"
 
 class timer_node;
 class http_conn;
@@ -38,8 +49,14 @@ class http_conn
 public:
 
     static const int FILENAME_LEN = 200;      // 文件名的最大长度
-    static const int READ_BUFFER_SIZE=2048;   // 读缓冲区的大小
-    static const int WRITE_BUFFER_SIZE=1024;  // 写缓冲区的大小
+    static const int MAX_REQUEST_SIZE=65536;  // 读缓冲区最多缓存的字节数，一个请求(含消息体)不能超过它
+    static const int MAX_PIPELINE=16;         // 流水线请求一次最多处理的个数，它们的响应合并为一次writev
+    static const int MAX_RANGES=4;            // 多范围请求最多发送的范围个数(合并重叠的之后)，更多时发送整个文件
+    // 一个响应最多占的iovec：普通响应3个，响应头可能跨两个块，加上文件；
+    // 多范围响应每个范围的分段头和文件各占一段，加上结尾的分隔符
+    static const int MAX_RESPONSE_IOV=3*MAX_RANGES+2;
+    static const int MAX_IOV=3*(MAX_PIPELINE-1)+MAX_RESPONSE_IOV;
+    static const int ACCESS_PATH_LEN=128;     // 访问日志中路径的最大长度，更长的截断
 
     // HTTP请求方法，这里只支持GET
     enum METHOD {GET = 0, POST, HEAD, PUT, DELETE, TRACE, OPTIONS, CONNECT};
@@ -60,25 +77,34 @@ public:
         NO_RESOURCE         :   表示服务器没有资源
         FORBIDDEN_REQUEST   :   表示客户对资源没有足够的访问权限
         FILE_REQUEST        :   文件请求,获取文件成功
+        NOT_MODIFIED        :   条件请求，客户端缓存的文件没有变化
+        RANGE_NOT_SATISFIABLE:  请求的字节范围都不在文件内
         INTERNAL_ERROR      :   表示服务器内部错误
         CLOSED_CONNECTION   :   表示客户端已经关闭连接了
     */
-    enum HTTP_CODE { NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION };
+    enum HTTP_CODE { NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, NOT_MODIFIED, RANGE_NOT_SATISFIABLE, INTERNAL_ERROR, CLOSED_CONNECTION };
     
     // 从状态机的三种可能状态，即行的读取状态，分别表示:
     // 1.读取到一个完整的行 2.行出错 3.行数据尚且不完整
     enum LINE_STATUS { LINE_OK = 0, LINE_BAD, LINE_OPEN };
 
 public:
-    http_conn (){} // 
+    http_conn (){ timer.user_data = this; } // 
     ~http_conn (){}
 
 public:
-    void init(int sockfd,const sockaddr_in &addr); // 初始化新接收的连接
+    void init(int sockfd,const sockaddr_in &addr,poller *poll,SPHttp *users); // 初始化新接收的连接
     void close_conn();  // 关闭连接
     void release_conn();     // 释放连接
+    void reject_busy();      // 服务器过载，回复503后关闭连接
     bool read();  // 非阻塞的读
     bool write(); //非阻塞的写
+    bool read_from(const char *data, int len); // 数据已经由poller读出(io_uring)，拷贝到读缓冲区
+    int get_write_iov(struct iovec **iov);     // 取出待发送的iovec，由poller异步写(io_uring)
+    int advance(int bytes);                    // 写出bytes字节后更新发送进度
+    bool is_linger() { return m_keep_alive && !m_more; } // 写完后是否直接等待下一次读
+    bool pipelined() { return m_more && bytes_to_send == 0; } // 响应已经写完，读缓冲区中还有流水线请求要处理
+    bool idle() { return m_read_buf.head() == nullptr; } // 没有占用读缓冲区，上一个请求已经处理完
     void process(); // 处理客户端的请求
     sockaddr_in *get_address() { return &m_address; } // 返回通信的socket地址
     int get_sockfd() { return m_sockfd; } // 返回当前的通信描述符
@@ -87,6 +113,10 @@ public:
 
 private:
     void init(); // 初始化请求处理相关信息
+    void init_request();  // 一个请求处理完，准备解析读缓冲区中的下一个请求
+    void init_response(); // 响应发送完，清空写状态，读缓冲区全部处理完时也清空
+    void add_iov( char *base, int len );    // 追加一段待发送的数据
+    void add_write_iov( buffer_pos start ); // 写缓冲区中从start开始的数据加入待发送的iovec
 
     HTTP_CODE process_read();               // 解析HTTP请求
     bool process_write( HTTP_CODE ret );    // 填充HTTP应答
@@ -94,73 +124,131 @@ private:
     // 下面这一组函数被process_read调用以分析HTTP请求
     HTTP_CODE parse_request_line(char *text);   // 解析请求首行
     HTTP_CODE parse_headers(char *text);        // 解析请求头
-    HTTP_CODE parse_content(char *text);        // 解析请求体
+    HTTP_CODE parse_content();                  // 解析请求体
     LINE_STATUS parse_line();                   // 读取一行
-    char * get_line(){return m_read_buf+m_start_line;} // 获取每行
+    LINE_STATUS finish_line(buffer_block *blk, int idx); // 行在blk的idx处('\r')结束，取出这一行
+    char * get_line(){return m_line;}           // 获取每行
     HTTP_CODE do_request();
+    int response_status( HTTP_CODE ret );   // 响应的状态码
+    void add_access( HTTP_CODE ret, int bytes, int queue_us, time_p &last );  // 按采样率记下本批中的一个请求
+    void log_access();      // 本批响应发完，写入记下的请求
 
     // 这一组函数被process_write调用以填充HTTP应答。
-    void unmap();
+    void release_files();   // 释放本批响应引用的文件，不在缓存中的文件随之关闭
+    void use_response_cache();  // 小文件改用响应缓存中的完整响应
+    bool want_gzip( off_t size );   // 是否发送gzip压缩的表示
+    HTTP_CODE serve_file();         // 已经取得目标文件，处理范围请求，选择响应缓存
+    int parse_range( off_t size );  // 解析Range头，结果放在m_ranges
+    bool if_range_match();          // If-Range是否和当前文件一致
+    bool add_ranges();              // 206响应，单个范围或multipart/byteranges
+    bool not_modified( ino_t ino, off_t size, time_t mtime, long mtime_ns );  // 生成ETag，判断条件请求
+    void add_file( int fd, off_t off, int len );    // 追加一段由sendfile发送的文件
+    void add_file_range( off_t off, off_t len );    // 追加目标文件的一段，有映射时直接发送映射，否则用sendfile
     bool add_response( const char* format, ... );
     bool add_content( const char* content );
-    bool add_content_type();
+    bool add_content_type( const char* type );
     bool add_status_line( int status, const char* title );
     bool add_headers( int content_length );
     bool add_content_length( int content_length );
+    bool add_vary();
+    bool add_validators();
+    bool add_accept_ranges();
     bool add_linger();
     bool add_blank_line();
 
 public:
-    static int m_epollfd;             // 所有套接字的事件都被注册到同一个epoll对象中
-    static int m_user_count;          // 统计用户的数量
+    static std::atomic<int> m_user_count; // 统计用户的数量，多个反应堆共享
     static sql_conn_pool *m_connPool; // 数据库连接池实例
 
     static const char *doc_root;      // 网站根目录
+    static bool m_sendfile;           // 文件用sendfile发送，不映射到用户空间
+    static int m_access_sample;       // 访问日志每多少个请求记一个，0不记
+    static int m_access_error_sample; // 状态码>=400的请求每多少个记一个，0不记
 
     static map<string, string> user_table;  // 静态数据库表
     static locker m_lock;                   // 静态锁
     
-    static std::unique_ptr<SPHttp[]> users;  // unique指针管理的静态指针数组
-                                            
-    std::weak_ptr<timer_node> timer;        // weekptr管理定时器，绑定一个定时器，week防止循环引用     
+    SPHttp *users;                          // 所属反应堆的连接表，释放连接时使用
+
+    timer_node timer;                       // 嵌入的定时器，由所属反应堆的时间轮链接，只在反应堆线程中访问
+    time_p queued_at;                       // 放入线程池请求队列的时间，用来统计排队时间
 
 private:
+    poller *m_poller; // 所属反应堆的poller，连接的事件都注册在它上面
     int m_sockfd; //该HTTP连接的socket
     sockaddr_in m_address; //通信的socket地址
 
     // 读与解析相关
-    char m_read_buf[READ_BUFFER_SIZE]; // 读缓冲区
-    int m_read_idx; //标识读缓冲区中以及读入的客户端数据的最后一个字节的下一个位置
+    chain_buffer m_read_buf;    // 读缓冲区，块链表，数据不会移动
+    chain_buffer m_scratch;     // 跨块的行和文件路径放在这里，每个请求开始时清空
     
-    int m_checked_idx; // 当前正在分析的字符在读缓冲区的位置
-    int m_start_line;    // 当前正在解析的行的起始位置
+    buffer_pos m_checked;   // 当前正在分析的字符在读缓冲区的位置
+    buffer_pos m_start_line;// 当前正在解析的行的起始位置
+    buffer_pos m_req_start; // 当前请求在读缓冲区中的起始位置，前面是已经处理完的流水线请求
+    char *m_line;           // 最近取出的一行，以'\0'结尾
+    int m_line_colon;       // m_line中第一个':'的下标，没有时为-1
+    int m_line_len;         // 正在解析的行已经扫描过的字节数
+    int m_colon;            // 正在解析的行中第一个':'的下标
+    bool m_more;         // 读缓冲区中还有没处理的流水线请求，本批响应写完后接着处理
 
     CHECK_STATE m_check_state; // 主状态机当前所处的状态
     
     // 解析对象相关
-    char m_real_file[ FILENAME_LEN ];// 客户请求的目标文件的完整路径，其内容等于 doc_root + m_url, doc_root是网站根目录
+    char *m_real_file;   // 客户请求的目标文件的完整路径，其内容等于 doc_root + m_url, doc_root是网站根目录，在m_scratch中分配
     char *m_url;         // 请求目标文件的文件名
     char *m_version;     // 协议版本，只支持HTTP1.1
     METHOD m_method;     // 请求方法
     char *m_host;        // 主机名
+    char *m_accept_encoding;    // 客户端支持的压缩格式
+    char *m_if_none_match;      // 条件请求，缓存的ETag
+    char *m_if_modified_since;  // 条件请求，缓存的修改时间
+    char *m_range;              // 请求的字节范围
+    char *m_if_range;           // 范围请求的条件
+    char *m_cookie;
     int m_content_length;                   // HTTP请求的消息总长度
     bool m_linger;       // HTTP请求是否要保持连接
+    bool m_keep_alive;   // 本批最后一个响应是否保持连接，写完后据此决定是否关闭
 
     // 写响应相关
-    char m_write_buf[ WRITE_BUFFER_SIZE ];  // 写缓冲区
-    int m_write_idx;                        // 写缓冲区中待发送的字节数
-
-    char* m_file_address;   // 客户请求的目标文件被mmap映射到内存中的起始位置
-    // 文件状态                   
-    struct stat m_file_stat;// 目标文件的状态。通过它我们可以判断文件是否存在、是否为目录、是否可读，并获取文件大小等信息
-    struct iovec m_iv[2];   // 我们将采用writev来执行写操作，所以定义下面两个成员，
-    int m_iv_count;         //其中m_iv_count表示被写内存块的数量。
+    chain_buffer m_write_buf;   // 写缓冲区，存放响应头和错误页面，块链表，每个块直接作为writev的iovec
+
+    SPFile m_file;          // 客户请求的目标文件，来自文件缓存，包含fd、大小和映射
+    char m_etag[ETAG_LEN];  // 目标文件的ETag，304和没有使用响应缓存的200响应用
+    time_t m_mtime;         // 目标文件的修改时间，即Last-Modified
+    struct byte_range { off_t first; off_t last; };     // 闭区间
+    byte_range m_ranges[MAX_RANGES];    // 范围请求要发送的范围，按起始位置排序，互不重叠
+    int m_range_count;      // 0表示发送整个文件
+    SPFile m_files[MAX_PIPELINE];   // 本批响应发送的文件，全部发送完后统一释放引用
+    int m_file_count;
+    SPResponse m_response;          // 小文件的完整响应，来自响应缓存
+    SPResponse m_responses[MAX_PIPELINE];   // 本批发送的缓存响应，全部发送完后统一释放引用
+    int m_response_count;
+    // 访问日志：本批中被采样的请求，响应全部发出后写入；发送时间从本批响应生成完到发完
+    struct access_entry {
+        int status;
+        METHOD method;
+        int bytes;
+        int queue_us;           // 在线程池请求队列中等待的时间，多反应堆模式为0
+        int parse_us;           // 解析请求和生成响应的时间
+        char path[ACCESS_PATH_LEN];
+    };
+    access_entry m_access[MAX_PIPELINE];
+    int m_access_count;
+    time_p m_ready_at;      // 本批响应生成完的时间
+    // 我们将采用writev来执行写操作，多个流水线请求的响应依次排列：响应头、文件、响应头、文件...
+    // 连续的响应头在写缓冲区中是相邻的，合并为一块
+    // sendfile模式下文件也占一个iovec，iov_base为空，iov_len是剩下的长度，fd和偏移在m_iv_file中
+    struct iovec m_iv[MAX_IOV];
+    struct { int fd; off_t off; } m_iv_file[MAX_IOV];
+    int m_iv_count;         // 被写内存块的数量
+    int m_iv_head;          // 第一个还没写完的内存块
     //发送
     int bytes_to_send;              // 将要发送的数据的字节数
     int bytes_have_send;            // 已经发送的字节数
     
     // POST和数据库相关
     int cgi;        // 是否启用的POST
+    bool m_close;   // 工作线程生成响应失败，由反应堆线程关闭连接
     std::string m_string; // 存储请求头数据
 };
 
@@ -0,0 +1,161 @@
+#ifndef HTTP_HEADER_H
+#define HTTP_HEADER_H
+
+#include <strings.h>
+
+/*
+    常用请求头字段名的完美哈希表，编译期生成
+    1.字段名按小写做FNV-1a哈希，编译时从1开始找一个种子，让所有已知字段名落在不同的槽里，找不到时编译失败
+    2.查找时算一次哈希，再和槽里的字段名比较一次(忽略大小写)，O(1)，已知字段再多也不会变慢
+    3.新支持一个字段只需要在header_id和known_headers中各加一项，在parse_headers中加一个case
+*/
+
+// 字段名对应的处理分支
+enum header_id {
+    HDR_UNKNOWN = 0,
+    HDR_HOST,
+    HDR_CONNECTION,
+    HDR_CONTENT_LENGTH,
+    HDR_CONTENT_TYPE,
+    HDR_TRANSFER_ENCODING,
+    HDR_ACCEPT,
+    HDR_ACCEPT_ENCODING,
+    HDR_ACCEPT_LANGUAGE,
+    HDR_USER_AGENT,
+    HDR_REFERER,
+    HDR_COOKIE,
+    HDR_ORIGIN,
+    HDR_AUTHORIZATION,
+    HDR_CACHE_CONTROL,
+    HDR_PRAGMA,
+    HDR_IF_NONE_MATCH,
+    HDR_IF_MODIFIED_SINCE,
+    HDR_RANGE,
+    HDR_IF_RANGE,
+    HDR_EXPECT,
+    HDR_UPGRADE,
+    HDR_KEEP_ALIVE,
+    HDR_TE,
+    HDR_DNT,
+    HDR_UPGRADE_INSECURE_REQUESTS,
+    HDR_SEC_FETCH_SITE,
+    HDR_SEC_FETCH_MODE,
+    HDR_SEC_FETCH_USER,
+    HDR_SEC_FETCH_DEST,
+    HDR_SEC_CH_UA,
+    HDR_SEC_CH_UA_MOBILE,
+    HDR_SEC_CH_UA_PLATFORM,
+};
+
+struct header_def {
+    const char *name;
+    header_id id;
+};
+
+static constexpr header_def known_headers[] = {
+    { "Host", HDR_HOST },
+    { "Connection", HDR_CONNECTION },
+    { "Content-Length", HDR_CONTENT_LENGTH },
+    { "Content-Type", HDR_CONTENT_TYPE },
+    { "Transfer-Encoding", HDR_TRANSFER_ENCODING },
+    { "Accept", HDR_ACCEPT },
+    { "Accept-Encoding", HDR_ACCEPT_ENCODING },
+    { "Accept-Language", HDR_ACCEPT_LANGUAGE },
+    { "User-Agent", HDR_USER_AGENT },
+    { "Referer", HDR_REFERER },
+    { "Cookie", HDR_COOKIE },
+    { "Origin", HDR_ORIGIN },
+    { "Authorization", HDR_AUTHORIZATION },
+    { "Cache-Control", HDR_CACHE_CONTROL },
+    { "Pragma", HDR_PRAGMA },
+    { "If-None-Match", HDR_IF_NONE_MATCH },
+    { "If-Modified-Since", HDR_IF_MODIFIED_SINCE },
+    { "Range", HDR_RANGE },
+    { "If-Range", HDR_IF_RANGE },
+    { "Expect", HDR_EXPECT },
+    { "Upgrade", HDR_UPGRADE },
+    { "Keep-Alive", HDR_KEEP_ALIVE },
+    { "TE", HDR_TE },
+    { "DNT", HDR_DNT },
+    { "Upgrade-Insecure-Requests", HDR_UPGRADE_INSECURE_REQUESTS },
+    { "Sec-Fetch-Site", HDR_SEC_FETCH_SITE },
+    { "Sec-Fetch-Mode", HDR_SEC_FETCH_MODE },
+    { "Sec-Fetch-User", HDR_SEC_FETCH_USER },
+    { "Sec-Fetch-Dest", HDR_SEC_FETCH_DEST },
+    { "sec-ch-ua", HDR_SEC_CH_UA },
+    { "sec-ch-ua-mobile", HDR_SEC_CH_UA_MOBILE },
+    { "sec-ch-ua-platform", HDR_SEC_CH_UA_PLATFORM },
+};
+
+static constexpr int HEADER_COUNT = sizeof(known_headers) / sizeof(known_headers[0]);
+static constexpr int HEADER_SLOTS = 128;   // 槽数，2的幂，比字段数大得多时容易找到种子
+
+// 哈希表的一个槽，name为空表示没有字段
+struct header_slot {
+    const char *name;
+    int len;
+    header_id id;
+};
+
+struct header_table {
+    unsigned seed;      // 为0表示没有找到完美哈希的种子
+    header_slot slots[HEADER_SLOTS];
+};
+
+constexpr int header_strlen(const char *s)
+{
+    int n = 0;
+    while (s[n]) {
+        ++n;
+    }
+    return n;
+}
+
+// FNV-1a，字母统一按小写计算；'|0x20'对非字母也会改变取值，但表和查找用同一个函数，结果一致
+constexpr unsigned header_hash(unsigned seed, const char *s, int len)
+{
+    unsigned h = 2166136261u ^ seed;
+    for (int i = 0; i < len; ++i) {
+        h = (h ^ (unsigned char)(s[i] | 0x20)) * 16777619u;
+    }
+    return (h ^ (h >> 15)) & (HEADER_SLOTS - 1);
+}
+
+// 从1开始逐个试种子，直到所有字段名都落在不同的槽里
+constexpr header_table make_header_table()
+{
+    for (unsigned seed = 1; seed < 4096; ++seed) {
+        header_table t = {};
+        bool ok = true;
+        for (int i = 0; i < HEADER_COUNT && ok; ++i) {
+            int len = header_strlen(known_headers[i].name);
+            unsigned slot = header_hash(seed, known_headers[i].name, len);
+            if (t.slots[slot].name) {
+                ok = false;
+            }
+            else {
+                t.slots[slot] = header_slot{ known_headers[i].name, len, known_headers[i].id };
+            }
+        }
+        if (ok) {
+            t.seed = seed;
+            return t;
+        }
+    }
+    return header_table{};
+}
+
+static constexpr header_table header_lookup_table = make_header_table();
+static_assert(header_lookup_table.seed != 0, "no perfect hash seed for known_headers, increase HEADER_SLOTS");
+
+// 字段名(不含':')对应的处理分支，不认识的返回HDR_UNKNOWN
+static inline header_id lookup_header(const char *name, int len)
+{
+    const header_slot &slot = header_lookup_table.slots[header_hash(header_lookup_table.seed, name, len)];
+    if (slot.len == len && strncasecmp(slot.name, name, len) == 0) {
+        return slot.id;
+    }
+    return HDR_UNKNOWN;
+}
+
+#endif
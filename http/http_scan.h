@@ -0,0 +1,88 @@
+#ifndef HTTP_SCAN_H
+#define HTTP_SCAN_H
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/*
+    请求行和头部行的扫描，一次比较16/32字节
+    在[p, p+len)中找第一个'\r'或'\n'，返回它的下标，没有时返回len
+    同一遍扫描中记下行尾之前第一个':'的下标，头部行据此直接分出字段名和字段值
+    colon由调用者初始化为-1，已经找到过(>=0)时不再修改，一行分几次扫描时可以接着用
+    1.编译时带-mavx2(或-march=native)使用AVX2，每次32字节
+    2.x86-64默认有SSE2，每次16字节
+    3.其他平台和不足16字节的尾部逐字节扫描
+    只读取[p, p+len)范围内的数据，不会越界
+*/
+
+// 逐字节扫描，向量化之前的做法，也用来处理尾部
+inline int scan_line_scalar(const char *p, int len, int &colon)
+{
+    for (int i = 0; i < len; ++i) {
+        char c = p[i];
+        if (c == '\r' || c == '\n') {
+            return i;
+        }
+        if (c == ':' && colon < 0) {
+            colon = i;
+        }
+    }
+    return len;
+}
+
+// eol、col是一段数据中行尾字符和':'的位图，返回行尾下标，没有时返回-1
+inline int scan_mask(unsigned eol, unsigned col, int base, int &colon)
+{
+    if (colon < 0) {
+        // 只要行尾之前的':'
+        if (eol) {
+            col &= (eol & -eol) - 1;
+        }
+        if (col) {
+            colon = base + __builtin_ctz(col);
+        }
+    }
+    return eol ? base + __builtin_ctz(eol) : -1;
+}
+
+inline int scan_line(const char *p, int len, int &colon)
+{
+    int i = 0;
+#if defined(__AVX2__)
+    const __m256i cr32 = _mm256_set1_epi8('\r');
+    const __m256i lf32 = _mm256_set1_epi8('\n');
+    const __m256i co32 = _mm256_set1_epi8(':');
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        unsigned eol = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, cr32), _mm256_cmpeq_epi8(v, lf32)));
+        unsigned col = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, co32));
+        int end = scan_mask(eol, col, i, colon);
+        if (end >= 0) {
+            return end;
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i co = _mm_set1_epi8(':');
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        unsigned eol = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+        unsigned col = _mm_movemask_epi8(_mm_cmpeq_epi8(v, co));
+        int end = scan_mask(eol, col, i, colon);
+        if (end >= 0) {
+            return end;
+        }
+    }
+#endif
+    int tail_colon = -1;
+    int end = i + scan_line_scalar(p + i, len - i, tail_colon);
+    if (colon < 0 && tail_colon >= 0) {
+        colon = i + tail_colon;
+    }
+    return end;
+}
+
+#endif
@@ -4,6 +4,12 @@
 #include <exception>
 #include <pthread.h>
 #include <semaphore.h>
+#include <atomic>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <time.h>
 
 // 线程同步机制封装类
 
@@ -39,6 +45,36 @@ private:
 };
 
 
+// 读写锁类，读多写少的共享数据(文件缓存)用它，读者之间不互斥
+class rwlocker {
+public:
+    rwlocker() {
+        if (pthread_rwlock_init(&m_rwlock, NULL) != 0) {
+            throw std::exception();
+        }
+    }
+
+    ~rwlocker() {
+        pthread_rwlock_destroy(&m_rwlock);
+    }
+
+    bool rdlock() {
+        return pthread_rwlock_rdlock(&m_rwlock) == 0;
+    }
+
+    bool wrlock() {
+        return pthread_rwlock_wrlock(&m_rwlock) == 0;
+    }
+
+    bool unlock() {
+        return pthread_rwlock_unlock(&m_rwlock) == 0;
+    }
+
+private:
+    pthread_rwlock_t m_rwlock;
+};
+
+
 // 条件变量类
 class cond {
 public:
@@ -100,6 +136,18 @@ public:
         // 对信号量加锁，调用一次对信号量的值-1，如果值为0，就阻塞
         return sem_wait( &m_sem ) == 0;
     }
+    // 最多等待ms毫秒，超时返回false
+    bool timewait( int ms ) {
+        struct timespec t;
+        clock_gettime( CLOCK_REALTIME, &t );
+        t.tv_sec += ms / 1000;
+        t.tv_nsec += ( ms % 1000 ) * 1000000L;
+        if ( t.tv_nsec >= 1000000000L ) {
+            t.tv_sec += 1;
+            t.tv_nsec -= 1000000000L;
+        }
+        return sem_timedwait( &m_sem, &t ) == 0;
+    }
     // 增加信号量
     bool post() {
         // 对信号量解锁，调用一次对信号量的值+1
@@ -109,4 +157,60 @@ private:
     sem_t m_sem;
 };
 
+
+/*
+    事件计数器，给无锁队列用的休眠/唤醒机制，相当于不需要互斥锁的条件变量
+    消费者：key=prepare_wait() -> 再检查一次队列 -> 有数据cancel_wait()，没有数据wait(key)
+    生产者：放入数据 -> notify_one()，没有等待者时只是一次原子读，不进入内核
+    64位计数：高32位是纪元(每次通知+1)，低32位是等待者个数，futex等待在高32位上(小端)
+*/
+class event_count {
+public:
+    event_count() : m_val(0) {}
+
+    // 登记为等待者，返回当前纪元
+    uint32_t prepare_wait() {
+        uint64_t prev = m_val.fetch_add(1, std::memory_order_acq_rel);
+        return prev >> EPOCH_SHIFT;
+    }
+    // 登记后发现条件已经满足，取消等待
+    void cancel_wait() {
+        m_val.fetch_sub(1, std::memory_order_seq_cst);
+    }
+    // 纪元没有变化就睡眠，直到被通知
+    void wait(uint32_t epoch) {
+        while ((m_val.load(std::memory_order_acquire) >> EPOCH_SHIFT) == epoch) {
+            syscall(SYS_futex, epoch_addr(), FUTEX_WAIT_PRIVATE, epoch, NULL, NULL, 0);
+        }
+        m_val.fetch_sub(1, std::memory_order_seq_cst);
+    }
+    // 唤醒一个等待者
+    void notify_one() { notify(1); }
+    // 唤醒全部等待者
+    void notify_all() { notify(INT32_MAX); }
+    // 最多唤醒n个等待者，一次futex调用
+    void notify(int n) {
+        // 和prepare_wait()配对，保证要么等待者能看到新数据，要么这里能看到等待者
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if ((m_val.load(std::memory_order_relaxed) & WAITER_MASK) == 0) {
+            return;
+        }
+        m_val.fetch_add(1ULL << EPOCH_SHIFT, std::memory_order_acq_rel);
+        syscall(SYS_futex, epoch_addr(), FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+    }
+
+private:
+    static const int EPOCH_SHIFT = 32;
+    static const uint64_t WAITER_MASK = (1ULL << EPOCH_SHIFT) - 1;
+
+    // 高32位的地址，只支持小端
+    static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "event_count needs little endian");
+    int *epoch_addr() {
+        return reinterpret_cast<int *>(&m_val) + 1;
+    }
+
+private:
+    std::atomic<uint64_t> m_val;
+};
+
 #endif
\ No newline at end of file
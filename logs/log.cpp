@@ -1,33 +1,46 @@
 #include "log.h"
 #include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <zlib.h>
 
 int Log::m_log_flag = 0;// 类外初始化
+std::atomic<int> Log::m_levels[LOG_MODULES] = {
+    {LOG_LEVEL_OFF}, {LOG_LEVEL_OFF}, {LOG_LEVEL_OFF}, {LOG_LEVEL_OFF}, {LOG_LEVEL_OFF}
+};
 
-Log::Log(){
+static const char *module_names[LOG_MODULES] = { "server", "http", "timer", "sql", "pool" };
+static const char *level_names[LOG_LEVEL_OFF + 1] = { "debug", "info", "warn", "error", "off" };
+
+// 每个线程缓存当前秒的时间字符串，一秒内只调用一次localtime_r
+static thread_local time_t t_sec = -1;
+static thread_local char t_time[80];  // 按%d的最大宽度留够空间
+static thread_local log_slot *t_slot[2] = { nullptr, nullptr };   // 运行日志和访问日志各一个
+
+Log::Log(bool access) : m_fp(nullptr), m_size(0), m_max_size(0), m_interval(0), m_rotate_at(0), m_rotate_due(false),
+    m_index(0), m_buf(nullptr), m_access(access), m_async(false), m_slot_count(0), m_dropped(0),
+    m_binary(false), m_formats_written(0) {
     m_count = 0;
-    m_log_flag=0;// 默认是关闭的
 }
 Log::~Log(){
     if(m_fp!=NULL){
         fclose(m_fp);
     }
 }
-// 异步需要设置阻塞队列的长度，同步不需要设置
+// 异步需要启动写线程，同步不需要
 bool Log::init(const char *file_name, int log_flag, int log_buf_size,
                  int max_lines, int max_deq_size)
 {
-    m_log_flag = log_flag;// 修改静态成员变量
-    // 如果设置了max_deq_size,则设置为异步模式
-    if(max_deq_size>=1)
-    {
-        m_log_deq = new BlockDeque<string>(max_deq_size);
-        pthread_t tid;
-        // //flush_log_thread为回调函数,这里表示创建线程异步写日志
-        pthread_create(&tid, NULL, flush_log_thread, NULL);
+    // 访问日志不改变运行日志的开关
+    if (!m_access) {
+        m_log_flag = log_flag;// 修改静态成员变量
     }
 
-    // 创建日志缓冲区
-    m_log_buf_size = log_buf_size;
+    // 一行的最大长度，同步模式的格式化缓冲区
+    m_log_buf_size = log_buf_size < LOG_BUFFER_SIZE ? log_buf_size : LOG_BUFFER_SIZE;
     m_buf = new char[m_log_buf_size];
     memset(m_buf, '\0', m_log_buf_size);
 
@@ -35,8 +48,8 @@ bool Log::init(const char *file_name, int log_flag, int log_buf_size,
 
     // 获取当前时间，结构体tm
     time_t t = time(nullptr);
-    struct tm *sys_tm = localtime(&t);
-    struct tm my_tm = *sys_tm;// 避免悬空指针，代码更清晰，方便修改
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
 
     // 从后往前找到第一个 / 的位置
     const char *p = strrchr(file_name, '/');
@@ -44,8 +57,8 @@ bool Log::init(const char *file_name, int log_flag, int log_buf_size,
 
     // 若输入的文件名没有 /，则直接将时间+文件名作为日志名
     if(p==nullptr){
-        snprintf(log_full_name, 255, "%d_%02d_%02d_%s", my_tm.tm_year + 1900,
-                 my_tm.tm_mon + 1, my_tm.tm_mday, file_name);
+        dir_name[0] = '\0';
+        strcpy(log_name, file_name);
     }
     else{
         // 将路径名复制到dir_name中,并创建这个目录
@@ -56,124 +69,538 @@ bool Log::init(const char *file_name, int log_flag, int log_buf_size,
             if (mkdir(dir_name, 0777) != 0) {
                 perror("mkdir error");
                 return false;
-            }   
+            }
         }
         // 将文件名复制到log_name中，加1是因为 p 指向的是 /
         strcpy(log_name, p + 1);
         // cout << "log name=" << log_name << endl;
-        snprintf(log_full_name, 255, "%s%d_%02d_%02d_%s", dir_name, my_tm.tm_year + 1900,
-                 my_tm.tm_mon + 1, my_tm.tm_mday, log_name);
-        // printf("%s\n", log_full_name);
+    }
+    // 重启后追加到当天没有压缩过的文件，压缩过的跳过，否则压缩时会覆盖之前的.gz
+    m_index = 0;
+    while (true) {
+        char gz[260];
+        file_path(log_full_name, sizeof(log_full_name), my_tm, m_index);
+        snprintf(gz, sizeof(gz), "%s.gz", log_full_name);
+        if (access(gz, F_OK) != 0) {
+            break;
+        }
+        ++m_index;
     }
 
     m_today = my_tm.tm_mday;
+    m_rotate_at = next_rotate(t);
 
     m_fp = fopen(log_full_name, "a");
     if (m_fp==nullptr)  return false;
+    strcpy(m_path, log_full_name);
+
+    // 打开文件之后各模块才开始写日志，默认全部级别都写
+    for (int i = 0; !m_access && i < LOG_MODULES; ++i) {
+        m_levels[i].store(LOG_LEVEL_DEBUG, std::memory_order_relaxed);
+    }
+
+    // 二进制模式，0号格式留给写线程记录丢弃的行数
+    if (log_flag == 3) {
+        m_binary = true;
+        register_format(2, "%ld log lines dropped", "i");
+    }
+
+    // 如果设置了max_deq_size,则设置为异步模式，各线程写自己的缓冲区，由写线程批量写入文件
+    // 二进制模式只能是异步的
+    if(max_deq_size>=1 || m_binary)
+    {
+        m_async = true;
+    }
+    // 同步模式也启动写线程，由它换文件，写日志的线程不会因为换文件阻塞
+    pthread_t tid;
+    //flush_log_thread为回调函数,这里表示创建线程异步写日志
+    pthread_create(&tid, NULL, flush_log_thread, this);
+    pthread_detach(tid);
+    if (LOG_GZIP_LEVEL > 0) {
+        pthread_create(&tid, NULL, compress_log_thread, this);
+        pthread_detach(tid);
+    }
     return true;
 }
 
-// 写日志
-void Log::write_log(int level,const char *format,...)
+void Log::set_rotate(long long max_size, int interval)
+{
+    m_max_size = max_size > 0 ? max_size : 0;
+    m_interval = interval > 0 ? interval : 0;
+}
+
+void Log::file_path(char *path, int len, const struct tm &my_tm, int index)
+{
+    if (index == 0) {
+        snprintf(path, len, "%s%d_%02d_%02d_%s", dir_name, my_tm.tm_year + 1900,
+                 my_tm.tm_mon + 1, my_tm.tm_mday, log_name);
+    }
+    else {
+        snprintf(path, len, "%s%d_%02d_%02d_%s_%d", dir_name, my_tm.tm_year + 1900,
+                 my_tm.tm_mon + 1, my_tm.tm_mday, log_name, index);
+    }
+}
+
+time_t Log::next_rotate(time_t now)
+{
+    struct tm my_tm;
+    localtime_r(&now, &my_tm);
+    my_tm.tm_mday += 1;
+    my_tm.tm_hour = 0;
+    my_tm.tm_min = 0;
+    my_tm.tm_sec = 0;
+    my_tm.tm_isdst = -1;
+    time_t at = mktime(&my_tm);
+    if (m_interval > 0 && now - now % m_interval + m_interval < at) {
+        at = now - now % m_interval + m_interval;
+    }
+    return at;
+}
+
+void Log::set_level(int module, int level)
+{
+    if (m_log_flag == 0 || module < 0 || module >= LOG_MODULES) {
+        return;
+    }
+    m_levels[module].store(level, std::memory_order_relaxed);
+}
+
+bool Log::set_levels(const char *spec)
+{
+    std::string str(spec);
+    size_t pos = 0;
+    while (pos <= str.size()) {
+        size_t end = str.find(',', pos);
+        if (end == std::string::npos) {
+            end = str.size();
+        }
+        std::string item = str.substr(pos, end - pos);
+        pos = end + 1;
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) {
+            return false;
+        }
+        std::string name = item.substr(0, eq);
+        std::string value = item.substr(eq + 1);
+
+        int level = -1;
+        for (int i = 0; i <= LOG_LEVEL_OFF; ++i) {
+            if (value == level_names[i] || (value.size() == 1 && value[0] == '0' + i)) {
+                level = i;
+            }
+        }
+        if (level < 0) {
+            return false;
+        }
+        if (name == "all") {
+            for (int i = 0; i < LOG_MODULES; ++i) {
+                set_level(i, level);
+            }
+            continue;
+        }
+        int module = -1;
+        for (int i = 0; i < LOG_MODULES; ++i) {
+            if (name == module_names[i]) {
+                module = i;
+            }
+        }
+        if (module < 0) {
+            return false;
+        }
+        set_level(module, level);
+    }
+    return true;
+}
+
+log_slot *Log::local_slot()
+{
+    if (t_slot[m_access]) {
+        return t_slot[m_access];
+    }
+    m_slot_lock.lock();
+    int n = m_slot_count.load(std::memory_order_relaxed);
+    if (n < LOG_MAX_THREADS) {
+        // 一块当前缓冲区，一块留给写线程定时交换，其余放入空闲队列
+        log_slot *slot = new log_slot;
+        for (int i = 0; i < LOG_BUFFERS; ++i) {
+            log_buffer *buf = new log_buffer;
+            buf->len = 0;
+            buf->lines = 0;
+            if (i == 0) {
+                slot->cur.store(buf, std::memory_order_relaxed);
+            }
+            else if (i == 1) {
+                slot->spare = buf;
+            }
+            else {
+                slot->free.push(buf);
+            }
+        }
+        m_slots[n] = slot;
+        m_slot_count.store(n + 1, std::memory_order_release);
+        t_slot[m_access] = slot;
+    }
+    m_slot_lock.unlock();
+    return t_slot[m_access];
+}
+
+int Log::format_line(char *dst, int size, int level, const char *format, va_list valst)
 {
     struct timeval now = {0, 0};
     gettimeofday(&now, NULL);
-    time_t t = now.tv_sec;
-    struct tm *sys_tm = localtime(&t);
-    struct tm my_tm = *sys_tm;
-    char s[16] = {0};
+    if (now.tv_sec != t_sec) {
+        struct tm my_tm;
+        localtime_r(&now.tv_sec, &my_tm);
+        snprintf(t_time, sizeof(t_time), "%d-%02d-%02d %02d:%02d:%02d",
+                 my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
+                 my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec);
+        t_sec = now.tv_sec;
+    }
 
     // 日志分级
+    const char *s;
     switch (level)
     {
     case 0:
-        strcpy(s, "[debug]:");
-        break;
-    case 1:
-        strcpy(s, "[info]:");
+        s = "[debug]:";
         break;
     case 2:
-        strcpy(s, "[warn]:");
+        s = "[warn]:";
         break;
     case 3:
-        strcpy(s, "[erro]:");
+        s = "[erro]:";
         break;
     default:
-        strcpy(s, "[info]:");
+        s = "[info]:";
         break;
     }
-    // 上个锁
-    m_mutex.lock();
 
-    // 更新现有行数
-    m_count++;
+    // 写入内容格式：时间 + 内容，超长的内容截断，留一个字节给换行
+    int n = m_access ? snprintf(dst, size, "%s.%06ld ", t_time, now.tv_usec)
+                     : snprintf(dst, size, "%s.%06ld %s ", t_time, now.tv_usec, s);
+    int m = vsnprintf(dst + n, size - n - 1, format, valst);
+    if (m < 0) {
+        m = 0;
+    }
+    if (m > size - n - 2) {
+        m = size - n - 2;
+    }
+    dst[n + m] = '\n';
+    return n + m + 1;
+}
 
-    //如果日志不是今天的 或 写入的日志行数是最大行的倍数
-    if(m_today!= my_tm.tm_mday || m_count % m_max_lines==0)
-    {
-        char new_log[256] = {0};
-        fflush(m_fp);//将缓冲区中的内容强制刷新到磁盘，确保数据被写入到文件
-        fclose(m_fp);
-        char tail[16] = {0};
-
-        // 格式化日志名中的时间部分
-        snprintf(tail, 16, "%d_%02d_%02d_", my_tm.tm_year + 1900,
-                 my_tm.tm_mon + 1, my_tm.tm_mday);
-        //如果时间不是今天，则创建今天的日志，更新m_doday和m_count
-        if(m_today!=my_tm.tm_mday)
-        {
-            snprintf(new_log, 255, "%s%s%s", dir_name, tail, log_name);
-            m_today = my_tm.tm_mday;
-            m_count = 0;
-        }else{
-        // 超过了最大行，在之前的日志名后面加上后缀，m_count/m_max_lines
-            snprintf(new_log, 255, "%s%s%s_%lld", dir_name, tail, log_name, m_count / m_max_lines);
-        }
-        m_fp = fopen(new_log, "a");
-    }
-    // 解锁
+log_buffer *Log::take_buffer(log_slot *slot)
+{
+    // 取出当前缓冲区，期间写线程不会取走它
+    log_buffer *buf = slot->cur.exchange(nullptr, std::memory_order_acquire);
+    if (LOG_BUFFER_SIZE - buf->len < m_log_buf_size) {
+        log_buffer *fresh = slot->free.pop();
+        if (!fresh) {
+            slot->cur.store(buf, std::memory_order_release);
+            return nullptr;
+        }
+        slot->full.push(buf);
+        m_wake.post();
+        buf = fresh;
+    }
+    return buf;
+}
+
+int Log::register_format(int level, const char *format, const char *types)
+{
+    log_format f;
+    f.level = level;
+    f.types = types;
+    f.format = format;
+    m_format_lock.lock();
+    int id = m_formats.size();
+    m_formats.push_back(f);
+    m_format_lock.unlock();
+    return id;
+}
+
+void Log::write_formats()
+{
+    std::string out;
+    m_format_lock.lock();
+    for (; m_formats_written < m_formats.size(); ++m_formats_written) {
+        const log_format &f = m_formats[m_formats_written];
+        log_record rec;
+        rec.id = LOG_FORMAT_RECORD;
+        rec.len = sizeof(rec) + 8 + f.types.size() + 1 + f.format.size() + 1;
+        rec.time = 0;
+        uint32_t id = m_formats_written;
+        int32_t level = f.level;
+        out.append((const char *)&rec, sizeof(rec));
+        out.append((const char *)&id, 4);
+        out.append((const char *)&level, 4);
+        out.append(f.types.c_str(), f.types.size() + 1);
+        out.append(f.format.c_str(), f.format.size() + 1);
+    }
+    m_format_lock.unlock();
+    fwrite(out.data(), 1, out.size(), m_fp);
+}
+
+// 写日志
+void Log::write_log(int level,const char *format,...)
+{
+    va_list valst;
+    va_start(valst, format);
+
+    log_slot *slot = m_async ? local_slot() : nullptr;
+    if (slot) {
+        log_buffer *buf = take_buffer(slot);
+        if (!buf) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            va_end(valst);
+            return;
+        }
+        buf->len += format_line(buf->data + buf->len, m_log_buf_size, level, format, valst);
+        buf->lines++;
+        slot->cur.store(buf, std::memory_order_release);
+        va_end(valst);
+        return;
+    }
+
+    // 同步模式(或者登记满了的线程)，加锁格式化并写入文件
+    m_mutex.lock();
+    int len = format_line(m_buf, m_log_buf_size, level, format, valst);
+    write_file(m_buf, len, 1);
+    if (!m_async) {
+        fflush(m_fp);
+    }
     m_mutex.unlock();
+    va_end(valst);
+}
 
-    // 初始化可变参数列表format->valst
-    va_list val;
-    va_start(val, format);
+void Log::write_file(const char *data, int len, int lines)
+{
+    // 二进制日志中格式定义在用到它的日志之前
+    if (m_binary) {
+        write_formats();
+    }
+    fwrite(data, 1, len, m_fp);
+    m_count += lines;
+    m_size += len;
+
+    // 到了第二天、下一个间隔，或者行数、大小超过上限，通知写线程换文件，换好之前继续写当前文件
+    if (!m_rotate_due && ((m_max_lines > 0 && m_count >= m_max_lines)
+        || (m_max_size > 0 && m_size >= m_max_size) || time(nullptr) >= m_rotate_at)) {
+        m_rotate_due = true;
+        m_wake.post();
+    }
+}
 
-    string log_str;
-    //加锁构建字符串log_str
+void Log::rotate()
+{
     m_mutex.lock();
+    bool due = m_rotate_due;
+    m_mutex.unlock();
+    if (!due) {
+        return;
+    }
+
+    time_t t = time(nullptr);
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
+    // 新的一天从不带后缀的文件开始，否则后缀加一；跳过已经存在的(重启之前写的)，不追加到要压缩或者已经压缩的文件中
+    int index = m_today != my_tm.tm_mday ? 0 : m_index + 1;
+    char path[256];
+    char gz[260];
+    while (true) {
+        file_path(path, sizeof(path), my_tm, index);
+        snprintf(gz, sizeof(gz), "%s.gz", path);
+        if (strcmp(path, m_path) != 0 && access(path, F_OK) != 0 && access(gz, F_OK) != 0) {
+            break;
+        }
+        ++index;
+    }
+    FILE *fp = fopen(path, "a");
+    // 打开失败继续写旧文件，下一轮再试
+    if (!fp) {
+        return;
+    }
 
-    // 写入内容格式：时间 + 内容
-    // 时间格式化，snprintf成功返回写字符的总数，不包括结尾的 \0 字符
-    int n = snprintf(m_buf, 48, "%d-%02d-%02d %02d:%02d:%02d.%06ld %s ",
-                     my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
-                     my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, now.tv_usec, s);
-
-    // 内容格式化，用于向字符串中打印数据，数据格式用户自定义，返回写入到字符数组str中的字符个数
-    int m = vsnprintf(m_buf + n, m_log_buf_size - 1, format, val);
-    m_buf[n + m] = '\n';
-    m_buf[n + m + 1] = '\0';
-    log_str = m_buf;
-    // 解锁
+    m_mutex.lock();
+    FILE *old = m_fp;
+    m_fp = fp;
+    std::string old_path = m_path;
+    strcpy(m_path, path);
+    m_count = 0;
+    m_size = 0;
+    m_formats_written = 0;
+    m_rotate_at = next_rotate(t);
+    m_rotate_due = false;
     m_mutex.unlock();
+    m_today = my_tm.tm_mday;
+    m_index = index;
 
-    // 异步加入阻塞队列，同步加锁写到文件中
-    if(m_log_flag==1 && !m_log_deq->full())
-    {
-        m_log_deq->push(log_str);
+    fclose(old);
+    if (LOG_GZIP_LEVEL > 0) {
+        m_compress_lock.lock();
+        m_compress_queue.push_back(old_path);
+        m_compress_lock.unlock();
+        m_compress_sem.post();
     }
-    else{
+}
+
+// 压缩成path.gz，先写临时文件，完成后改名并删除原文件，失败时保留原文件
+static bool gzip_file(const std::string &path)
+{
+    std::string gz = path + ".gz";
+    std::string tmp = gz + ".tmp";
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    char mode[8];
+    snprintf(mode, sizeof(mode), "wb%d", LOG_GZIP_LEVEL);
+    gzFile out = gzopen(tmp.c_str(), mode);
+    if (!out) {
+        close(fd);
+        return false;
+    }
+    bool ok = true;
+    char buf[65536];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        if (gzwrite(out, buf, n) != n) {
+            ok = false;
+            break;
+        }
+    }
+    if (n < 0) {
+        ok = false;
+    }
+    // 原文件马上要删除，不让它留在页缓存中挤占服务的文件
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+    if (gzclose(out) != Z_OK) {
+        ok = false;
+    }
+    if (!ok || rename(tmp.c_str(), gz.c_str()) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    unlink(path.c_str());
+    return true;
+}
+
+void Log::compress_files()
+{
+    // 压缩不和请求处理争抢：CPU用最低的nice值，IO用idle调度类(ioprio_set，IOPRIO_CLASS_IDLE为3)
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+    syscall(SYS_ioprio_set, 1, 0, 3 << 13);
+    while (true) {
+        m_compress_sem.wait();
+        m_compress_lock.lock();
+        if (m_compress_queue.empty()) {
+            m_compress_lock.unlock();
+            continue;
+        }
+        std::string path = m_compress_queue.front();
+        m_compress_queue.pop_front();
+        m_compress_lock.unlock();
+        if (!gzip_file(path)) {
+            LOG_WARN("compress log file %s failure", path.c_str());
+        }
+    }
+}
+
+void Log::drain(bool all)
+{
+    m_drain_lock.lock();
+    int n = m_slot_count.load(std::memory_order_acquire);
+    for (int i = 0; i < n; ++i) {
+        log_slot *slot = m_slots[i];
+        log_buffer *done[LOG_BUFFERS + 1];
+        int count = 0;
+        log_buffer *buf;
+        while ((buf = slot->full.pop()) != nullptr) {
+            done[count++] = buf;
+        }
+        // 取走没写满的：cur和取出时一样(线程没有在追加)才交换成功
+        if (all && slot->spare) {
+            buf = slot->cur.load(std::memory_order_acquire);
+            if (buf && buf->len > 0
+                && slot->cur.compare_exchange_strong(buf, slot->spare, std::memory_order_acq_rel)) {
+                slot->spare = nullptr;
+                done[count++] = buf;
+            }
+        }
+        if (count == 0) {
+            continue;
+        }
         m_mutex.lock();
-        // c_str() 是 C++ 字符串类的一个成员函数，用于返回一个指向字符串的 const char* 指针
-        fputs(log_str.c_str(), m_fp);
+        for (int j = 0; j < count; ++j) {
+            write_file(done[j]->data, done[j]->len, done[j]->lines);
+        }
         m_mutex.unlock();
+        // 写完的缓冲区先补上spare，其余还给线程
+        for (int j = 0; j < count; ++j) {
+            done[j]->len = 0;
+            done[j]->lines = 0;
+            if (!slot->spare) {
+                slot->spare = done[j];
+            }
+            else {
+                slot->free.push(done[j]);
+            }
+        }
+    }
+    m_mutex.lock();
+    long dropped = m_dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0 && m_binary) {
+        char line[sizeof(log_record) + 8];
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        log_record rec;
+        rec.id = 0;
+        rec.len = sizeof(line);
+        rec.time = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+        memcpy(line, &rec, sizeof(rec));
+        int64_t n = dropped;
+        memcpy(line + sizeof(rec), &n, 8);
+        write_file(line, sizeof(line), 1);
+    }
+    else if (dropped > 0) {
+        char line[64];
+        int len = snprintf(line, sizeof(line), "[warn]: %ld log lines dropped\n", dropped);
+        write_file(line, len, 1);
+    }
+    fflush(m_fp);
+    m_mutex.unlock();
+    m_drain_lock.unlock();
+}
+
+void Log::async_write_log()
+{
+    struct timespec last;
+    clock_gettime(CLOCK_MONOTONIC, &last);
+    while (true) {
+        // 被写满的缓冲区唤醒时只取写满的，距离上次全部取走超过LOG_FLUSH_MS时没写满的也取走
+        // 一直有缓冲区写满时不会超时，所以按时间判断而不是按是否超时
+        m_wake.timewait(LOG_FLUSH_MS);
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long ms = (now.tv_sec - last.tv_sec) * 1000 + (now.tv_nsec - last.tv_nsec) / 1000000;
+        bool all = ms >= LOG_FLUSH_MS;
+        if (all) {
+            last = now;
+        }
+        drain(all);
+        rotate();
     }
-    va_end(val);
 }
 
 // 强制刷新缓冲区
 void Log::flush(void)
 {
+    if (m_async) {
+        drain(true);
+        return;
+    }
     m_mutex.lock();
     fflush(m_fp);
     m_mutex.unlock();
-}
\ No newline at end of file
+}
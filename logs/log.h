@@ -6,79 +6,371 @@
 #include <string.h>
 #include <stdarg.h>
 #include <pthread.h>
+#include <sys/time.h>
+#include <time.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <deque>
+#include <type_traits>
 
 #include "../lock/locker.h"
-#include "block_deque.h"
+#include "log_format.h"
 
 using namespace std;
 
+#define LOG_BUFFER_SIZE (64 * 1024)   // 每个线程一块日志缓冲区的大小，写满后整块交给写线程
+#define LOG_BUFFERS 4                 // 每个线程的缓冲区个数：一块正在写，其余在写线程手中或者在空闲队列中
+#define LOG_MAX_THREADS 256           // 最多登记的写日志线程，更多的线程同步写
+#define LOG_FLUSH_MS 1000             // 写线程定时取走没写满的缓冲区，日志最多延迟这么久落盘
+#define LOG_GZIP_LEVEL 6              // 换下来的日志文件在后台用gzip压缩的级别，0不压缩
+
+// 一块日志缓冲区，里面是格式化好的若干行
+struct log_buffer {
+    int len;
+    int lines;
+    char data[LOG_BUFFER_SIZE];
+};
+
+// 单生产者单消费者的缓冲区队列，容量等于一个线程的缓冲区总数，不会满
+struct log_ring {
+    log_buffer *bufs[LOG_BUFFERS];
+    std::atomic<unsigned> head;     // 消费者取出的位置
+    std::atomic<unsigned> tail;     // 生产者放入的位置
+
+    log_ring() : head(0), tail(0) {}
+    void push(log_buffer *buf) {
+        unsigned t = tail.load(std::memory_order_relaxed);
+        bufs[t % LOG_BUFFERS] = buf;
+        tail.store(t + 1, std::memory_order_release);
+    }
+    log_buffer *pop() {
+        unsigned h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        log_buffer *buf = bufs[h % LOG_BUFFERS];
+        head.store(h + 1, std::memory_order_release);
+        return buf;
+    }
+};
+
+/*
+    一个写日志线程的缓冲区，线程第一次写日志时登记，之后不再释放(服务器的线程都是常驻的)
+    1.线程追加时把cur换成空指针，写完再放回，期间写线程不会取走它，没有锁
+    2.写满时放入full，从free取一块空的继续写，并唤醒写线程；free也是空的说明写线程跟不上，丢弃这一行并计数
+    3.写线程定时用spare中的空缓冲区和cur做CAS交换，取走没写满的，cur为空(线程正在追加)时下次再取
+*/
+struct log_slot {
+    std::atomic<log_buffer *> cur;
+    log_ring full;                  // 线程 -> 写线程
+    log_ring free;                  // 写线程 -> 线程
+    log_buffer *spare;              // 写线程私有的空缓冲区，只由写线程访问
+
+    log_slot() : cur(nullptr), spare(nullptr) {}
+};
+
+/*
+    二进制日志参数的类型编码和写入，格式见log_format.h
+    只支持整数、枚举、浮点数、字符串和指针，其他类型(如std::string)编译不通过
+    put写入一个参数，空间不够时返回空
+*/
+template <typename T, typename Enable = void>
+struct log_arg;
+
+template <typename T>
+struct log_arg<T, typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type> {
+    static constexpr char code = std::is_unsigned<T>::value ? 'u' : 'i';
+    static char *put(char *p, char *end, T v) {
+        if (end - p < 8) {
+            return nullptr;
+        }
+        int64_t x = (int64_t)v;
+        memcpy(p, &x, 8);
+        return p + 8;
+    }
+};
+
+template <typename T>
+struct log_arg<T, typename std::enable_if<std::is_floating_point<T>::value>::type> {
+    static constexpr char code = 'd';
+    static char *put(char *p, char *end, T v) {
+        if (end - p < 8) {
+            return nullptr;
+        }
+        double x = v;
+        memcpy(p, &x, 8);
+        return p + 8;
+    }
+};
+
+template <typename T>
+struct log_arg<T, typename std::enable_if<std::is_same<T, char *>::value || std::is_same<T, const char *>::value>::type> {
+    static constexpr char code = 's';
+    static char *put(char *p, char *end, const char *v) {
+        if (!v) {
+            v = "(null)";
+        }
+        if (end - p < 4) {
+            return nullptr;
+        }
+        uint32_t n = strnlen(v, LOG_STR_MAX);
+        if (n > end - p - 4) {
+            n = end - p - 4;
+        }
+        memcpy(p, &n, 4);
+        memcpy(p + 4, v, n);
+        return p + 4 + n;
+    }
+};
+
+template <typename T>
+struct log_arg<T, typename std::enable_if<std::is_pointer<T>::value
+    && !std::is_same<T, char *>::value && !std::is_same<T, const char *>::value>::type> {
+    static constexpr char code = 'p';
+    static char *put(char *p, char *end, T v) {
+        if (end - p < 8) {
+            return nullptr;
+        }
+        uint64_t x = (uintptr_t)v;
+        memcpy(p, &x, 8);
+        return p + 8;
+    }
+};
+
+inline char *log_put(char *p, char *end) {
+    return p;
+}
+
+template <typename T, typename... Args>
+char *log_put(char *p, char *end, const T &v, const Args &... args) {
+    p = log_arg<typename std::decay<T>::type>::put(p, end, v);
+    return p ? log_put(p, end, args...) : nullptr;
+}
+
+// 参数类型串，只在decltype中使用，不求值参数
+template <typename... Args>
+struct log_sig {
+    static const char *str() {
+        static const char s[] = { log_arg<typename std::decay<Args>::type>::code..., '\0' };
+        return s;
+    }
+};
+
+template <typename... Args>
+log_sig<Args...> log_arg_types(const Args &...);
+
+// 日志级别
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_OFF 4
+
+// 编译时的最低级别，低于它的日志语句连同参数一起被编译器删掉，如编译时加-DLOG_MIN_LEVEL=1去掉全部debug日志
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+// 日志所属的模块，每个模块有自己的运行时级别
+enum log_module {
+    LOG_SERVER,     // 启动、反应堆、文件缓存等
+    LOG_HTTP,       // 连接的读写和请求处理
+    LOG_TIMER,      // 定时器
+    LOG_SQL,        // 数据库连接池和查询
+    LOG_POOL,       // 线程池
+    LOG_MODULES
+};
+
+// 源文件在包含任何头文件之前定义LOG_MODULE，指定本文件中LOG_DEBUG等宏所属的模块，没有定义的属于LOG_SERVER
+#ifndef LOG_MODULE
+#define LOG_MODULE LOG_SERVER
+#endif
+
 class Log
 {
 public:
 
-    // 可选择的参数有日志文件、日志缓冲区大小、最大行数以及阻塞队列最大长度
-    bool init(const char *file_name,int log_flag, int log_buf_size = 8192, 
+    // 可选择的参数有日志文件、一行日志的最大长度、最大行数，max_deque_size大于0时为异步模式
+    bool init(const char *file_name,int log_flag, int log_buf_size = 8192,
         int split_lines = 5000000, int max_deque_size = 0);
 
     // C++11 规定了静态对象的初始化顺序，确保了在多线程环境下，静态对象只会被初始化一次。
     // C++11以后，使用局部静态变量懒汉不用加锁
     static Log* get_instance()
     {
-        static Log inst;
+        static Log inst(false);
+        return &inst;
+    }
+
+    // 访问日志，单独的文件，同样经过各线程的缓冲区和写线程，每行不带级别，不受m_log_flag和模块级别控制
+    static Log* get_access()
+    {
+        static Log inst(true);
         return &inst;
     }
 
-    // 异步写日志公有方法，调用私有方法async_write_log
+    // 异步写日志线程的入口，调用私有方法async_write_log
     static void *flush_log_thread(void *args)
     {
-        Log::get_instance()->async_write_log();
+        ((Log *)args)->async_write_log();
+        return nullptr;
+    }
+
+    // 压缩线程的入口
+    static void *compress_log_thread(void *args)
+    {
+        ((Log *)args)->compress_files();
+        return nullptr;
     }
 
     // 将输出内容按照标准格式整理
     void write_log(int level,const char *format,...);
 
-    // 强制刷新缓冲区
+    // 强制刷新缓冲区，异步模式下把所有线程缓冲区中的日志写入文件
     void flush(void);
 
-private:
-    Log();
-    virtual ~Log();
+    // 换文件的策略，在init之前调用：文件超过max_size字节(0不限制)，或者每interval秒(0只按天)换一个新文件
+    // 按天和按行数(init的split_lines)换文件一直有效
+    void set_rotate(long long max_size, int interval);
+
+    // 设置一个模块的运行时级别，日志系统关闭时不生效
+    static void set_level(int module, int level);
+    // 按"http=warn,timer=1"的格式设置各模块的级别，模块名all表示全部，级别可以是名字或者0~4，格式错误返回false
+    static bool set_levels(const char *spec);
 
-    // 异步写日志方法
-    void *async_write_log()
+    // 二进制模式：登记一个调用点的格式串，返回格式编号，每个调用点只在第一次执行时调用
+    int register_format(int level, const char *format, const char *types);
+
+    // 二进制模式：只追加格式编号、时间戳和参数的原始字节，不做格式化，由logdecode还原成文本
+    template <typename... Args>
+    void write_binary(int id, const Args &... args)
     {
-        string single_log;
-        //从阻塞队列取一个日志文件string，写入文件
-        while(m_log_deq->pop(single_log))
-        {
-            // 取成功，则加锁写入磁盘
-            m_mutex.lock();
-            fputs(single_log.c_str(), m_fp);
-            m_mutex.unlock();
+        log_slot *slot = local_slot();
+        log_buffer *buf = slot ? take_buffer(slot) : nullptr;
+        if (!buf) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        char *start = buf->data + buf->len;
+        char *end = log_put(start + sizeof(log_record), start + m_log_buf_size, args...);
+        if (end) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            log_record rec;
+            rec.id = id;
+            rec.len = end - start;
+            rec.time = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+            memcpy(start, &rec, sizeof(rec));
+            buf->len += rec.len;
+            buf->lines++;
         }
+        else {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+        slot->cur.store(buf, std::memory_order_release);
     }
+
+private:
+    Log(bool access);
+    virtual ~Log();
+
+    // 异步写日志方法，等待写满的缓冲区，超时后也取走没写满的；到了换文件的时候由它换文件
+    void async_write_log();
+    // 写线程换文件：在锁外打开新文件，加锁只交换文件指针和计数，换下来的文件在锁外关闭后交给压缩线程
+    void rotate();
+    // 下一次按时间换文件的时刻：第二天零点，或者更早的下一个间隔
+    time_t next_rotate(time_t now);
+    // 第index个文件的文件名，0号不带后缀
+    void file_path(char *path, int len, const struct tm &my_tm, int index);
+    // 压缩线程，以最低的CPU和IO优先级依次压缩换下来的文件
+    void compress_files();
+    // 取走各线程写满的缓冲区写入文件，all为true时没写满的也取走
+    void drain(bool all);
+    // 当前线程的缓冲区，第一次调用时登记，登记满了返回空
+    log_slot *local_slot();
+    // 取出当前线程的缓冲区用来追加，剩下的空间不够一行时换一块空的；没有空的返回空，这一行丢弃
+    // 追加完用slot->cur.store放回
+    log_buffer *take_buffer(log_slot *slot);
+    // 二进制模式下写入还没写到当前文件的格式定义，调用者持有m_mutex
+    void write_formats();
+    // 格式化一行，包括时间和级别，返回长度，超长时截断
+    int format_line(char *dst, int size, int level, const char *format, va_list valst);
+    // 写入文件，写完检查是否需要换文件，需要时通知写线程，调用者持有m_mutex
+    void write_file(const char *data, int len, int lines);
+
 public:
-    static int m_log_flag;               // 日志标记，0/关闭，1/异步，2/同步
+    static int m_log_flag;               // 日志标记，0/关闭，1/异步，2/同步，3/二进制异步
+    // 各模块的最低级别，日志语句只做一次relaxed读取和比较，关闭时都是LOG_LEVEL_OFF
+    static std::atomic<int> m_levels[LOG_MODULES];
 
 private:
 
     char dir_name[128]; // 路径名
     char log_name[128]; // 日志文件名
     int m_max_lines;    // 日志最大行数
-    int m_log_buf_size; // 日志缓冲区大小
+    int m_log_buf_size; // 一行日志的最大长度
     long long m_count;  // 日志当前行数
     int m_today;        // 按天分类，记录当前时间是哪一天
     FILE *m_fp;         // 打开的日志文件指针
-    char *m_buf;        // 要输出的内容
-    BlockDeque<string> *m_log_deq;// 阻塞队列
-    locker m_mutex;               // 互斥锁
-    
+    char m_path[256];   // 当前文件名
+
+    // 换文件，m_count、m_size、m_rotate_at、m_rotate_due由m_mutex保护，m_today、m_index只由写线程访问
+    long long m_size;       // 当前文件的字节数
+    long long m_max_size;   // 按大小换文件，0不限制
+    int m_interval;         // 按时间间隔换文件(秒)，0只按天
+    time_t m_rotate_at;     // 到这个时刻换文件
+    bool m_rotate_due;      // 需要换文件，等写线程执行
+    int m_index;            // 当前文件是当天的第几个
+
+    // 等待压缩的文件
+    std::deque<std::string> m_compress_queue;
+    locker m_compress_lock;
+    sem m_compress_sem;
+    char *m_buf;        // 同步模式下格式化的缓冲区
+    locker m_mutex;     // 保护日志文件和同步模式的缓冲区
+
+    bool m_access;      // 访问日志
+    bool m_async;
+    log_slot *m_slots[LOG_MAX_THREADS];
+    std::atomic<int> m_slot_count;
+    locker m_slot_lock;             // 登记线程时使用
+    locker m_drain_lock;            // 写线程和flush()不同时取缓冲区
+    sem m_wake;                     // 有缓冲区写满时唤醒写线程
+    std::atomic<long> m_dropped;    // 写线程跟不上时丢弃的行数
+
+    // 二进制模式登记的格式，编号是下标，0号是丢弃计数
+    struct log_format {
+        int level;
+        std::string types;
+        std::string format;
+    };
+    bool m_binary;
+    std::vector<log_format> m_formats;
+    locker m_format_lock;
+    size_t m_formats_written;       // 当前文件中已经写入的格式个数，换文件时清零
 };
 
-// 这四个宏定义在其他文件中使用，主要用于不同类型的日志输出
-#define LOG_DEBUG(format, ...)if(Log::m_log_flag) {Log::get_instance()->write_log(0, format, ##__VA_ARGS__); Log::get_instance()->flush();}
-#define LOG_INFO(format, ...) if(Log::m_log_flag) {Log::get_instance()->write_log(1, format, ##__VA_ARGS__); Log::get_instance()->flush();}
-#define LOG_WARN(format, ...) if(Log::m_log_flag) {Log::get_instance()->write_log(2, format, ##__VA_ARGS__); Log::get_instance()->flush();}
-#define LOG_ERROR(format, ...) if(Log::m_log_flag) {Log::get_instance()->write_log(3, format, ##__VA_ARGS__); Log::get_instance()->flush();}
+// 二进制模式下每个调用点用静态变量保存格式编号，第一次执行时登记，参数类型在编译时由decltype得到
+#define LOG_BASE(level, format, ...) \
+    if(Log::m_log_flag == 3) { \
+        static const int log_format_id = Log::get_instance()->register_format(level, format, \
+            decltype(log_arg_types(__VA_ARGS__))::str()); \
+        Log::get_instance()->write_binary(log_format_id, ##__VA_ARGS__); \
+    } \
+    else {Log::get_instance()->write_log(level, format, ##__VA_ARGS__);}
+
+// 写入指定模块的日志，级别低于LOG_MIN_LEVEL时条件在编译时为假，整条语句被删掉
+// 否则只比较模块的运行时级别，不满足时不求值任何参数
+#define LOG_TO(module, level, format, ...) \
+    if((level) >= LOG_MIN_LEVEL && (level) >= Log::m_levels[module].load(std::memory_order_relaxed)) \
+        {LOG_BASE(level, format, ##__VA_ARGS__)}
+
+// 这四个宏定义在其他文件中使用，主要用于不同类型的日志输出，属于当前文件的LOG_MODULE
+#define LOG_DEBUG(format, ...) LOG_TO(LOG_MODULE, LOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
+#define LOG_INFO(format, ...) LOG_TO(LOG_MODULE, LOG_LEVEL_INFO, format, ##__VA_ARGS__)
+#define LOG_WARN(format, ...) LOG_TO(LOG_MODULE, LOG_LEVEL_WARN, format, ##__VA_ARGS__)
+#define LOG_ERROR(format, ...) LOG_TO(LOG_MODULE, LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
 
 #endif
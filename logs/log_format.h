@@ -0,0 +1,24 @@
+#ifndef LOG_FORMAT_H
+#define LOG_FORMAT_H
+
+#include <stdint.h>
+
+/*
+    二进制日志的文件格式，日志系统和logdecode共用
+    文件由一条条记录组成，每条记录以log_record开头，len是包括log_record在内的整条记录的长度
+    1.格式定义记录：id为LOG_FORMAT_RECORD，后面是格式编号(uint32)、级别(int32)、参数类型串、格式串，两个串都以'\0'结尾
+      每个文件开头写入已经登记的全部格式，之后有新格式登记时在它的第一条日志之前追加，每个文件都能单独解码
+    2.日志记录：id是格式编号，time是纳秒时间戳，后面按参数类型串依次是参数：
+      i/u 有符号/无符号整数，p 指针，都存8字节；d 浮点数，存double；s 字符串，存uint32长度加内容(没有'\0')
+    整数按本机字节序存放，解码要在同一种机器上进行
+*/
+#define LOG_FORMAT_RECORD 0xffffffffu
+#define LOG_STR_MAX 512     // 字符串参数的最大长度，更长的截断
+
+struct log_record {
+    uint32_t id;
+    uint32_t len;
+    int64_t time;
+};
+
+#endif
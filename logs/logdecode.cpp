@@ -0,0 +1,281 @@
+// 二进制日志解码工具，把服务器以日志模式3写出的文件还原成和文本日志相同格式的行
+// 用法：./logdecode log_file/2024_01_01_BinServerLog [更多文件...]，结果输出到标准输出
+// 换文件后压缩过的.gz文件直接解码
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <zlib.h>
+#include <string>
+#include <vector>
+#include "log_format.h"
+
+struct format_def {
+    int level;
+    std::string types;
+    std::string format;
+};
+
+static std::vector<format_def> formats;
+
+static const char *level_name(int level)
+{
+    switch (level) {
+    case 0:
+        return "[debug]:";
+    case 2:
+        return "[warn]:";
+    case 3:
+        return "[erro]:";
+    default:
+        return "[info]:";
+    }
+}
+
+// 一个已经读出的参数
+struct arg_value {
+    char type;
+    int64_t i;
+    double d;
+    std::string s;
+};
+
+// 从记录中依次取出参数，数据不够时停止
+static std::vector<arg_value> read_args(const std::string &types, const char *p, const char *end)
+{
+    std::vector<arg_value> args;
+    for (char t : types) {
+        arg_value v;
+        v.type = t;
+        v.i = 0;
+        v.d = 0;
+        if (t == 's') {
+            uint32_t n;
+            if (end - p < 4) {
+                break;
+            }
+            memcpy(&n, p, 4);
+            p += 4;
+            if (n > (uint32_t)(end - p)) {
+                break;
+            }
+            v.s.assign(p, n);
+            p += n;
+        }
+        else {
+            if (end - p < 8) {
+                break;
+            }
+            if (t == 'd') {
+                memcpy(&v.d, p, 8);
+            }
+            else {
+                memcpy(&v.i, p, 8);
+            }
+            p += 8;
+        }
+        args.push_back(v);
+    }
+    return args;
+}
+
+// 按格式串输出，每个转换说明单独交给snprintf，参数按记录中的类型转换成格式要求的类型
+static std::string format_message(const std::string &format, const std::vector<arg_value> &args)
+{
+    std::string out;
+    size_t next = 0;
+    char buf[1024];
+    const char *f = format.c_str();
+    while (*f) {
+        if (*f != '%') {
+            out.push_back(*f++);
+            continue;
+        }
+        if (f[1] == '%') {
+            out.push_back('%');
+            f += 2;
+            continue;
+        }
+        // 标志、宽度、精度，'*'从参数中取
+        std::string spec = "%";
+        ++f;
+        while (*f && strchr("-+ #0'", *f)) {
+            spec.push_back(*f++);
+        }
+        for (int part = 0; part < 2; ++part) {
+            if (part == 1) {
+                if (*f != '.') {
+                    break;
+                }
+                spec.push_back(*f++);
+            }
+            if (*f == '*') {
+                int n = next < args.size() ? (int)args[next++].i : 0;
+                spec += std::to_string(n);
+                ++f;
+            }
+            while (*f >= '0' && *f <= '9') {
+                spec.push_back(*f++);
+            }
+        }
+        // 长度修饰符统一换成ll或者去掉，参数在记录中都是8字节
+        std::string length;
+        while (*f && strchr("hlLqjzt", *f)) {
+            length.push_back(*f++);
+        }
+        char conv = *f;
+        if (conv == '\0') {
+            break;
+        }
+        ++f;
+        if (next >= args.size()) {
+            out += "<?>";
+            continue;
+        }
+        const arg_value &v = args[next++];
+        switch (conv) {
+        case 'd':
+        case 'i': {
+            long long x = v.i;
+            // 没有长度修饰符时参数是int，按int截断，和printf的结果一致
+            if (length.empty()) {
+                x = (int)x;
+            }
+            else if (length == "h") {
+                x = (short)x;
+            }
+            else if (length == "hh") {
+                x = (signed char)x;
+            }
+            snprintf(buf, sizeof(buf), (spec + "ll" + conv).c_str(), x);
+            break;
+        }
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X': {
+            unsigned long long x = (unsigned long long)v.i;
+            if (length.empty()) {
+                x = (unsigned int)x;
+            }
+            else if (length == "h") {
+                x = (unsigned short)x;
+            }
+            else if (length == "hh") {
+                x = (unsigned char)x;
+            }
+            snprintf(buf, sizeof(buf), (spec + "ll" + conv).c_str(), x);
+            break;
+        }
+        case 'c':
+            snprintf(buf, sizeof(buf), (spec + conv).c_str(), (int)v.i);
+            break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            snprintf(buf, sizeof(buf), (spec + conv).c_str(), v.type == 'd' ? v.d : (double)v.i);
+            break;
+        case 's':
+            if (v.type == 's') {
+                snprintf(buf, sizeof(buf), (spec + conv).c_str(), v.s.c_str());
+            }
+            else {
+                snprintf(buf, sizeof(buf), "%lld", (long long)v.i);
+            }
+            break;
+        case 'p':
+            snprintf(buf, sizeof(buf), (spec + conv).c_str(), (void *)(uintptr_t)v.i);
+            break;
+        default:
+            snprintf(buf, sizeof(buf), "<%%%c?>", conv);
+            break;
+        }
+        out += buf;
+    }
+    return out;
+}
+
+static bool decode(const char *path)
+{
+    // gzread读没有压缩的文件时原样返回
+    gzFile fp = gzopen(path, "rb");
+    if (!fp) {
+        perror(path);
+        return false;
+    }
+    std::string data;
+    char chunk[65536];
+    int n;
+    while ((n = gzread(fp, chunk, sizeof(chunk))) > 0) {
+        data.append(chunk, n);
+    }
+    gzclose(fp);
+
+    const char *p = data.data();
+    const char *end = p + data.size();
+    while (end - p >= (long)sizeof(log_record)) {
+        log_record rec;
+        memcpy(&rec, p, sizeof(rec));
+        if (rec.len < sizeof(rec) || rec.len > (uint32_t)(end - p)) {
+            fprintf(stderr, "%s: bad record at offset %ld\n", path, (long)(p - data.data()));
+            return false;
+        }
+        const char *body = p + sizeof(rec);
+        const char *next = p + rec.len;
+        p = next;
+
+        if (rec.id == LOG_FORMAT_RECORD) {
+            uint32_t id;
+            int32_t level;
+            memcpy(&id, body, 4);
+            memcpy(&level, body + 4, 4);
+            const char *types = body + 8;
+            const char *format = types + strnlen(types, next - types) + 1;
+            if (format >= next) {
+                continue;
+            }
+            if (id >= formats.size()) {
+                formats.resize(id + 1);
+            }
+            formats[id].level = level;
+            formats[id].types = types;
+            formats[id].format.assign(format, strnlen(format, next - format));
+            continue;
+        }
+        if (rec.id >= formats.size()) {
+            printf("<unknown format %u>\n", rec.id);
+            continue;
+        }
+        const format_def &def = formats[rec.id];
+        time_t sec = rec.time / 1000000000;
+        long usec = (rec.time % 1000000000) / 1000;
+        struct tm my_tm;
+        localtime_r(&sec, &my_tm);
+        std::string msg = format_message(def.format, read_args(def.types, body, next));
+        printf("%d-%02d-%02d %02d:%02d:%02d.%06ld %s %s\n",
+               my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
+               my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, usec, level_name(def.level), msg.c_str());
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        printf("按照如下格式运行：%s binary_log_file...\n", argv[0]);
+        return 1;
+    }
+    int ret = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (!decode(argv[i])) {
+            ret = 1;
+        }
+    }
+    return ret;
+}
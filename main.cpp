@@ -7,6 +7,7 @@
 #include <fcntl.h>
 #include <sys/epoll.h>
 #include <signal.h>
+#include <sys/signalfd.h>
 #include <errno.h>
 #include <iostream>
 #include <memory>
@@ -14,38 +15,11 @@
 #include "./lock/locker.h"
 #include "./http/http_conn.h"
 #include "./threadpool/threadpool.h"
-#include "./Timer_lst/priorityTimer.h"
 #include "./MySQL/sql_conn_pool.h"
 #include "./logs/log.h"
+#include "./reactor/reactor.h"
 
-
-#define MAX_FD 65535 // 最大的文件描述符个数
-#define MAX_EVENT_NUMBER 15000 // 监听的最大的事件数量
-
-// 添加文件描述符到epoll中
-extern void addfd(int epollfd,int fd,bool one_shot);
-// 从epoll中删除文件描述符
-extern void removefd(int epollfd,int fd);
-// 修改文件描述符
-extern void modfd(int epollfd,int fd,int flag);
-// 设置非阻塞文件描述符
-extern int setnonblocking( int fd );
-
-static int pipefd[2]; //定义一个管道用于信号传输
-static timerQueue timer_queue; // 定时器链表/超时队列
-static int epfd; //epoll描述符
-
-// 处理定时信号，发送信号到写管道，使其用epoll监听读管道
-void sig_send( int sig )
-{
-    //为保证函数的可重入性，保留原来的errno
-    int save_errno = errno;
-    int msg = sig;
-    send(pipefd[1], (char *)&msg, 1, 0);
-    errno = save_errno;
-}
-
-// 注册信号捕捉：1.用于忽略管道破裂信号SIGPIPE，2.捕捉终止信号和定时信号
+// 注册信号捕捉：用于忽略管道破裂信号SIGPIPE，终止信号由signalfd同步读取，不再注册处理函数
 void addsig(int sig  ,void(handler)(int))
 {
     struct sigaction sa;
@@ -59,32 +33,80 @@ void addsig(int sig  ,void(handler)(int))
     assert( sigaction( sig, &sa, NULL ) != -1 );//注册信号
 }
 
-// epoll接收到信号后，优先处理IO，再执行此函数调用tick()来删除过期用户
-void timer_handler()
-{
-    LOG_INFO("%s, current client numbers are %d ", "The timer tick is working ...",http_conn::m_user_count);
-    // printf("The timer_handler is working ..., current client numbers are %d \n",http_conn::m_user_count);
-
-    timer_queue.tick();// 调用定时器的tick()函数，心搏函数
-    alarm(timer_queue.changeGap()); // 调整发送信号的时间
-}
-
-void show_error(int connfd, const char *info)
-{
-    printf("%s", info);
-    send(connfd, info, strlen(info), 0);
-    close(connfd);
-}
-
 int main(int argc, char *argv[])
 {
-    if(argc<3){
-        printf("按照如下格式运行：%s port_number log_flag\n",basename(argv[0]));
+    // 可选参数：-r 反应堆线程数，0为单反应堆+线程池模式；-b IO后端，epoll/uring；-m 读写缓冲区的内存预算(MB)，0不限制
+    // -s 文件用sendfile发送，不用mmap；-c 缓存完整响应(包括压缩的)的文件大小上限(KB)，0不缓存，超过的文本文件每次请求压缩；-z 不压缩文本文件
+    // -l 各模块的日志级别，如http=warn,timer=error；-R 日志文件的大小上限(MB)和换文件的间隔(分钟)，如64,60
+    // -a 访问日志的采样间隔，每N个请求记一个，逗号后是出错(>=400)请求的采样间隔，默认1全部记录
+    int reactor_num = 0;
+    int budget_mb = 0;
+    int response_kb = 16;
+    bool use_gzip = true;
+    bool use_sendfile = false;
+    const char *backend = "epoll";
+    const char *log_levels = nullptr;
+    int rotate_mb = 64;
+    int rotate_minutes = 0;
+    int access_sample = 0;
+    int access_error_sample = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:b:m:sc:zl:R:a:")) != -1) {
+        switch (opt) {
+        case 'r':
+            reactor_num = atoi(optarg);
+            break;
+        case 'b':
+            backend = optarg;
+            break;
+        case 'm':
+            budget_mb = atoi(optarg);
+            break;
+        case 's':
+            use_sendfile = true;
+            break;
+        case 'c':
+            response_kb = atoi(optarg);
+            break;
+        case 'z':
+            use_gzip = false;
+            break;
+        case 'l':
+            log_levels = optarg;
+            break;
+        case 'R':
+            rotate_mb = atoi(optarg);
+            if (strchr(optarg, ',')) {
+                rotate_minutes = atoi(strchr(optarg, ',') + 1);
+            }
+            break;
+        case 'a':
+            access_sample = atoi(optarg);
+            if (strchr(optarg, ',')) {
+                access_error_sample = atoi(strchr(optarg, ',') + 1);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    if(argc-optind<2){
+        printf("按照如下格式运行：%s port_number log_flag [-r reactor_num] [-b epoll|uring] [-m budget_mb] [-s] [-c response_kb] [-z] [-l module=level,...] [-R size_mb[,minutes]] [-a sample[,error_sample]]\n",basename(argv[0]));
         exit(-1);
     }
 
+    // 屏蔽终止信号，必须在创建任何线程(异步日志、线程池、反应堆)之前，让所有线程都继承这个屏蔽字，
+    // 信号只会挂起在进程上，由主线程通过signalfd读取，不会打断工作线程的系统调用
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    int sigfd = signalfd(-1, &mask, SFD_CLOEXEC);
+    assert(sigfd != -1);
+
     // 设置日志
-    int log_flag = atoi(argv[2]);
+    int log_flag = atoi(argv[optind+1]);
+    Log::get_instance()->set_rotate((long long)rotate_mb << 20, rotate_minutes * 60);
     if (log_flag==1)
     { 
         // 异步日志
@@ -99,20 +121,44 @@ int main(int argc, char *argv[])
         LOG_INFO("同步日志开启！");
         printf("同步日志开启！\n");
     }
+    else if (log_flag==3)
+    {
+        // 二进制异步日志，用logdecode转换成文本
+        Log::get_instance()->init("log_file/BinServerLog",log_flag, 2000, 800000, 200);
+        LOG_INFO("二进制日志开启！");
+        printf("二进制日志开启！\n");
+    }
     else{
         log_flag = 0;
         printf("日志系统关闭！\n");
     }
+    if (log_flag != 0 && log_levels && !Log::set_levels(log_levels)) {
+        printf("日志级别格式错误：%s，模块为server/http/timer/sql/pool/all，级别为debug/info/warn/error/off\n", log_levels);
+        exit(-1);
+    }
+
+    // 访问日志，单独的文件，始终是异步的，和运行日志是否打开无关
+    if (access_sample > 0) {
+        Log::get_access()->set_rotate((long long)rotate_mb << 20, rotate_minutes * 60);
+        if (Log::get_access()->init("log_file/AccessLog", 1, 2000, 800000, 200)) {
+            http_conn::m_access_sample = access_sample;
+            http_conn::m_access_error_sample = access_error_sample;
+            printf("访问日志开启，采样间隔：%d，出错请求：%d\n", access_sample, access_error_sample);
+        }
+    }
 
     //获取端口号
-    int port=atoi(argv[1]);;
+    int port=atoi(argv[optind]);
     //int port=9999;
 
     // 对SIGPIE信号做处理，防止客户端意外断开连接，终止进程
-    // 对SIGALRM、SIGTERM设置信号处理函数
     addsig(SIGPIPE,SIG_IGN);
-    addsig(SIGALRM,sig_send);
-    addsig(SIGTERM,sig_send);
+
+    // 所有连接的读写缓冲区都从缓冲块池中取，超出预算时拒绝新的请求
+    if (budget_mb > 0) {
+        block_pool::GetInstance()->set_budget((size_t)budget_mb << 20);
+        LOG_INFO("buffer memory budget: %dMB", budget_mb);
+    }
 
     // 创建数据库连接池
     sql_conn_pool *connPool = sql_conn_pool::GetInstance();
@@ -123,216 +169,91 @@ int main(int argc, char *argv[])
     // 初始化网站根目录
     http_conn::doc_root = "/home/young/workspace/c++_work/webserver_all/MyWebServer/myroot/Web";
 
-    //创建线程池，初始化线程池
+    //创建线程池，初始化线程池，多反应堆模式下请求在反应堆线程内处理，不需要线程池
     threadpool<http_conn> *pool=nullptr;
-    try{
-        pool=new threadpool<http_conn>;
-    }catch(...){
-        exit(-1);
+    if (reactor_num <= 0) {
+        try{
+            pool=new threadpool<http_conn>;
+        }catch(...){
+            exit(-1);
+        }
     }
-    
-    // V1：http_conn *users=new http_conn[MAX_FD];// 静态数组法
-    // V2：std::vector<http_conn> users;// vector版本
-    // users.reserve(MAX_FD);
-    // V3：创建一个week智能指针数组来管理每一个连接对象
-    //  SPHttp users[MAX_FD]; //并没有初始化，指针指向空
-    // V4：智能指针数组和一个指向该数组的unique指针
-    http_conn::users = std::make_unique<SPHttp[]>(MAX_FD);
 
     //  静态方法初始化数据库静态表
     http_conn::initmysql_table();
 
-    // 创建监听套接字
-    int listenfd= socket(PF_INET,SOCK_STREAM,0);
-    if (listenfd == -1) {
-        perror("socket");
-        exit(-1);
+    // io_uring的提交队列只能由反应堆线程操作，工作线程不能直接重置事件，所以只用于多反应堆模式
+    if (strcmp(backend, "uring") == 0 && pool != nullptr) {
+        printf("io_uring只支持多反应堆模式(-r)，使用epoll\n");
+        backend = "epoll";
     }
+    // io_uring的写是异步提交的iovec，没有对应sendfile的操作，文件仍然用mmap
+    if (use_sendfile && strcmp(backend, "uring") == 0) {
+        printf("io_uring后端不支持sendfile，使用mmap\n");
+        use_sendfile = false;
+    }
+    http_conn::m_sendfile = use_sendfile;
 
-    // 设置端口复用
-    int opt=1;
-    setsockopt(listenfd,SOL_SOCKET,SO_REUSEPORT,&opt,sizeof(opt));
-
-    // 绑定
-    struct sockaddr_in address;
-    memset(&address,0,sizeof(address));
-    address.sin_family=AF_INET;
-    address.sin_addr.s_addr=INADDR_ANY;
-    address.sin_port=htons(port);
-    int ret=0;
-    ret=bind(listenfd, (struct sockaddr*)&address, sizeof(address));
-    assert(ret!=-1);
-
-    // 监听
-    listen(listenfd,1024);
-
-    // 创建epoll对象，事件数组，添加
-    epoll_event events[MAX_EVENT_NUMBER];
-    epfd=epoll_create(999);
-
-    // 将监听的文件描述符添加到epoll,fasle为非阻塞+LT模式
-    addfd(epfd,listenfd,false);
-    http_conn::m_epollfd=epfd;
+    // 文件缓存监视网站根目录，sendfile模式下不需要映射
+    if (!file_cache::GetInstance()->init(http_conn::doc_root, !use_sendfile)) {
+        printf("文件缓存启动失败，每次请求都打开文件\n");
+    }
+    // 响应缓存只缓存文件缓存中的文件，文件缓存没有启动时不起作用
+    response_cache::GetInstance()->set_threshold(response_kb * 1024);
+    response_cache::GetInstance()->set_gzip(use_gzip);
 
-    // 创建发送信号的管道，一端用于发送，一端用于监听
-    ret=socketpair(PF_UNIX,SOCK_STREAM,0,pipefd);
-    assert(ret!=-1);
-    setnonblocking(pipefd[1]);
-    addfd(epfd,pipefd[0],false);
+    // 创建反应堆，每个反应堆一个线程，单反应堆模式只有一个
+    int loop_num = reactor_num > 0 ? reactor_num : 1;
+    reactor **reactors = new reactor*[loop_num];
+    for (int i = 0; i < loop_num; ++i) {
+        reactors[i] = new reactor(port, pool, backend);
+        if (!reactors[i]->init() || !reactors[i]->start(reactor_num > 0 ? i : -1)) {
+            LOG_ERROR("reactor %d start failure!", i);
+            exit(-1);
+        }
+    }
+    if (reactor_num > 0) {
+        printf("多反应堆模式，反应堆线程数：%d\n", loop_num);
+        LOG_INFO("Multi-reactor mode, reactor threads: %d", loop_num);
+    }
 
-    alarm(TIMESLOT);
-    bool timeout=false;
+    // 主线程只等待终止信号，定时由各反应堆的timerfd负责，主线程没有事件循环，直接阻塞读signalfd
     bool stop_server=false;
     while (!stop_server)
     {
-        // epoll持续监听
-        int num=epoll_wait(epfd,events,MAX_EVENT_NUMBER,-1);
-        // 忽略因信号引起的中断
-        if((num<0)&&(errno!=EINTR)){
-            LOG_ERROR("epoll failure!");
-            break;
+        struct signalfd_siginfo si;
+        ssize_t ret=read(sigfd,&si,sizeof(si));
+        if(ret==-1 && errno==EINTR){
+            continue;
         }
-
-        //循环遍历事件数组
-        for(int i=0;i<num;i++) 
-        {
-            int curfd=events[i].data.fd;
-            //1. 有客户端连接进来
-            if(curfd==listenfd)
-            {
-                // 准备接收客户端信息
-                struct sockaddr_in client_address;
-                socklen_t client_addlen=sizeof(client_address);
-
-                int connfd=accept(listenfd, (struct sockaddr*)&client_address, &client_addlen);
-
-                if ( connfd < 0 ) {
-                    LOG_ERROR("%s:errno is:%d", "accept error", errno);
-                    continue;
-                } 
-                if(http_conn::m_user_count>=MAX_FD){
-                    // 最大支持的连接数已满
-                    // 给客户端写一个信息：服务器内部正忙
-                    show_error(connfd, "Internal Server Busy!");
-                    LOG_WARN("%s", "Internal server busy！");
-                    continue;
-                }
-                /*
-                判断智能指针管理的对象是否被销毁，
-                    1.如果不存在：初始化一个连接对象，交给它管理。初始化，同时创建定时器。
-                    2.如果存在：说明当前管理的这个连接对象已经被初始化了，但是还没被释放，只需要更新它的值
-                */
-                if (http_conn::users[connfd].get()==nullptr)
-                {
-                    // 让这个shared智能指针指向一个连接类对象
-                    // 强引用赋值给强引用，原来的自动销毁
-                    http_conn::users[connfd] = std::make_shared<http_conn>(); 
-                    // 正式对成员初始化
-                    http_conn::users[connfd]->init(connfd, client_address); 
-                    // 创建定时器,用sharedptr管理，再把这个sharedptr传出赋值给users中的弱定时器引用（weekptr）
-                    SPTNode temp_timer=timer_queue.add_timer( 3 * TIMESLOT);
-                    http_conn::users[connfd]->timer = temp_timer;
-                    // 再给定时器中的弱引用连接对象赋值，强引用赋值给弱引用
-                    temp_timer->user_data = http_conn::users[connfd];
-                    // 打印日志
-                    LOG_INFO("Connecting to a new client(%s) cfd(%d) ", inet_ntoa(client_address.sin_addr),connfd);
-                }
-                else
-                {
-                    http_conn::users[connfd]->init(connfd, client_address);    // 重新初始化该连接对象
-                    http_conn::users[connfd]->timer.lock()->upadte(3 * TIMESLOT); // 更新该连接对象的定时器
-                    http_conn::users[connfd]->timer.lock()->cancelDeleted(); // 重新连接就取消删除标记
-                    LOG_INFO("Reconnecting to a new client(%s) cfd(%d) ", inet_ntoa(client_address.sin_addr), connfd);
-                }
-            
-            }
-            //2. 处理管道中的信号
-            else if((curfd==pipefd[0]) && (events[i].events & EPOLLIN))
-            {
-                char signals[1024];
-                int ret=recv(pipefd[0],signals,sizeof(signals),0);
-                if(ret==-1 || ret==0){
-                    continue;
-                }else{
-                    for (int i = 0; i <ret; ++i){
-                    // switch中的是字符,case可以是字符,也可以是字符对应的ASCLL码
-                        switch (signals[i])
-                        {
-                        // 用timeout变量标记有定时任务需要处理，但不立即处理定时任务
-                        // 这是因为定时任务的优先级不是很高，我们优先处理其他更重要的任务。
-                        case SIGALRM:
-                            timeout = true; // IO优先，延时处理
-                            break;
-                        case SIGTERM:
-                            stop_server = true;
-                        }
-                    }
-                }
-
-            }
-            //3. 处理错误信息事件，客户端关闭连接，移除对应的定时器
-            else if(events[i].events & (EPOLLRDHUP|EPOLLHUP|EPOLLERR))
-            {
-                LOG_ERROR("Eroor messages or FIN in client(%s) cfd(%d)", inet_ntoa(http_conn::users[curfd]->get_address()->sin_addr), curfd);
-                // 对方异常断开或者错误事件
-                http_conn::users[curfd]->close_conn();
-            }
-            //4. 主线程处理客户端读事件
-            else if(events[i].events & EPOLLIN)
-            {
-                // 非阻塞IO，主线程一次性把所有数据都读完
-                // 从通信缓冲区读到该对象的读缓冲区内
-                if(http_conn::users[curfd]->read())
-                {
-                    LOG_INFO("Deal with the client(%s) cfd(%d)", inet_ntoa(http_conn::users[curfd]->get_address()->sin_addr),curfd);
-                    // 有数据传输，更新该客户端的定时器
-                    http_conn::users[curfd]->timer.lock()->upadte(3 * TIMESLOT);
-                    // 线程池把这个已经读取到客户请求（get/post/...）的请求对象放入请求队列
-                    // 交给工作线程去解析，工作线程解析请求后，把响应信息放到写缓冲区
-                    pool->append(http_conn::users[curfd].get()); // 把原始指针传过去
-                }
-                // 对方异常断开或者错误事件，和处理错误事件一样
-                else
-                {
-                    LOG_ERROR("Read error in client(%s) cfd(%d)", inet_ntoa(http_conn::users[curfd]->get_address()->sin_addr),curfd); 
-                    // 断开连接，关闭掉这个curfd的事件监听，同时标记删除定时器
-                    http_conn::users[curfd]->close_conn();
-                }
-            }
-            //5. 主线程处理客户端写事件
-            else if(events[i].events & EPOLLOUT)
-            {
-                // 非阻塞IO，主线程一次性写完所有数据，包括响应消息和html资源两部分
-                // 从对象的写缓冲区发送到通信缓冲区
-                if(http_conn::users[curfd]->write())
-                {
-                    // 写事件日志
-                    LOG_INFO("Send data to client(%s) cfd(%d)",inet_ntoa(http_conn::users[curfd]->get_address()->sin_addr), curfd);
-                    //更新该客户端的定时器
-                    http_conn::users[curfd]->timer.lock()->upadte( 3 * TIMESLOT);
-                }
-                //如果发生写错误 或 对方已经关闭连接，则服务端也关闭连接，标记删除定时器
-                else
-                {
-                    // 短连接测试不建议打印此条日志
-                    //LOG_ERROR("Write error in client(%s) cfd(%d)", inet_ntoa(http_conn::users[curfd]->get_address()->sin_addr),curfd);
-                    http_conn::users[curfd]->close_conn();
-                }
-            }
+        if(ret!=sizeof(si)){
+            break;
         }
-        // 最后处理alrm定时事件。这样做将导致定时任务不能精准的按照预定的时间执行
-        if(timeout){
-            // 执行定时清理
-            timer_handler();
-            timeout = false;
+        if (si.ssi_signo == SIGTERM){
+            stop_server = true;
         }
     }
-    close(epfd);
-    close(listenfd);
-    close(pipefd[0]);
-    close(pipefd[1]);
-    // delete[] users;
-    // delete[] client_users;
+
+    // 通知所有反应堆退出，等待线程结束
+    for (int i = 0; i < loop_num; ++i) {
+        reactors[i]->stop();
+    }
+    for (int i = 0; i < loop_num; ++i) {
+        reactors[i]->join();
+    }
+    // 先等工作线程退出，它们可能还在处理反应堆连接表中的连接对象
     delete pool;
+    for (int i = 0; i < loop_num; ++i) {
+        delete reactors[i];
+    }
+    delete[] reactors;
+    close(sigfd);
+    // 异步模式下各线程缓冲区中还没写入文件的日志
+    if (log_flag) {
+        Log::get_instance()->flush();
+    }
+    if (http_conn::m_access_sample > 0) {
+        Log::get_access()->flush();
+    }
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,72 @@
+#include <unistd.h>
+#include "epoller.h"
+
+epoller::epoller(int max_events) :
+        m_epollfd(-1), m_listenfd(-1), m_max_events(max_events)
+{
+    m_events = new epoll_event[max_events];
+}
+
+epoller::~epoller()
+{
+    if (m_epollfd != -1) close(m_epollfd);
+    delete[] m_events;
+}
+
+bool epoller::init()
+{
+    m_epollfd = epoll_create(999);
+    return m_epollfd != -1;
+}
+
+bool epoller::add_listen(int listenfd)
+{
+    // 将监听的文件描述符添加到epoll,fasle为非阻塞+LT模式
+    m_listenfd = listenfd;
+    addfd(m_epollfd, listenfd, false);
+    return true;
+}
+
+bool epoller::add_watch(int fd)
+{
+    addfd(m_epollfd, fd, false);
+    return true;
+}
+
+void epoller::add_conn(int fd)
+{
+    addfd(m_epollfd, fd, true);
+}
+
+void epoller::mod(int fd, int ev)
+{
+    modfd(m_epollfd, fd, ev);
+}
+
+void epoller::remove(int fd)
+{
+    removefd(m_epollfd, fd);
+}
+
+int epoller::wait(poll_event *events, int max_events, int timeout)
+{
+    if (max_events > m_max_events) max_events = m_max_events;
+    int num = epoll_wait(m_epollfd, m_events, max_events, timeout);
+    for (int i = 0; i < num; ++i)
+    {
+        poll_event &ev = events[i];
+        ev.fd = m_events[i].data.fd;
+        ev.res = -1;
+        ev.buf = nullptr;
+        ev.bid = -1;
+        if (ev.fd == m_listenfd)
+            ev.type = EV_ACCEPT;
+        else if (m_events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            ev.type = EV_ERROR;
+        else if (m_events[i].events & EPOLLIN)
+            ev.type = EV_READ;
+        else
+            ev.type = EV_WRITE;
+    }
+    return num;
+}
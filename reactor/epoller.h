@@ -0,0 +1,36 @@
+#ifndef EPOLLER_H
+#define EPOLLER_H
+
+#include <sys/epoll.h>
+#include "poller.h"
+
+// 添加文件描述符到epoll中
+extern void addfd(int epollfd,int fd,bool one_shot);
+// 从epoll中删除文件描述符
+extern void removefd(int epollfd,int fd);
+// 修改文件描述符
+extern void modfd(int epollfd,int fd,int flag);
+
+// epoll实现：监听套接字LT模式，连接ET+EPOLLONESHOT模式
+class epoller : public poller
+{
+public:
+    epoller(int max_events);
+    ~epoller();
+
+    bool init() override;
+    bool add_listen(int listenfd) override;
+    bool add_watch(int fd) override;
+    void add_conn(int fd) override;
+    void mod(int fd, int ev) override;
+    void remove(int fd) override;
+    int wait(poll_event *events, int max_events, int timeout) override;
+
+private:
+    int m_epollfd;              // epoll对象
+    int m_listenfd;             // 监听套接字，用来区分EV_ACCEPT
+    int m_max_events;           // 就绪事件数组大小
+    epoll_event *m_events;      // epoll_wait的就绪事件数组
+};
+
+#endif
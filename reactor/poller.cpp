@@ -0,0 +1,26 @@
+#include <string.h>
+#include "poller.h"
+#include "epoller.h"
+#include "uring_poller.h"
+#include "reactor.h"
+
+poller *create_poller(const char *backend)
+{
+    if (backend && strcmp(backend, "uring") == 0)
+    {
+        // 读缓冲区和连接的读缓冲区一样大，一次recv的数据一定放得下
+        poller *p = new uring_poller(4096, 1024, BUFFER_BLOCK_SIZE);
+        if (p->init()) {
+            return p;
+        }
+        delete p;
+        LOG_WARN("%s", "io_uring is not available, fall back to epoll");
+        printf("io_uring不可用，回退到epoll\n");
+    }
+    poller *p = new epoller(MAX_EVENT_NUMBER);
+    if (!p->init()) {
+        delete p;
+        return nullptr;
+    }
+    return p;
+}
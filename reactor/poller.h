@@ -0,0 +1,57 @@
+#ifndef POLLER_H
+#define POLLER_H
+
+#include <sys/uio.h>
+
+/*
+    事件类型，反应堆只关心下面几种事件，具体由哪种IO多路复用机制产生由poller决定
+    EV_ACCEPT   :   有新连接。epoll时res为-1，需要反应堆自己accept；io_uring时res就是新连接的fd
+    EV_READ     :   可读。buf为空时需要自己recv(epoll)；buf不为空时数据已经读到buf中，长度为res(io_uring)
+    EV_WRITE    :   可写，由反应堆把写缓冲区发出去
+    EV_WRITTEN  :   异步写完成(io_uring)，res为本次写出的字节数或-errno
+    EV_ERROR    :   对方关闭连接或者出错
+*/
+enum POLL_EVENT { EV_ACCEPT = 0, EV_READ, EV_WRITE, EV_WRITTEN, EV_ERROR };
+
+struct poll_event
+{
+    int type;   // 事件类型
+    int fd;     // 事件对应的文件描述符
+    int res;    // 事件结果，含义见上
+    char *buf;  // io_uring读完成时数据所在的缓冲区，用完后要recycle归还
+    int bid;    // 缓冲区编号
+};
+
+// IO多路复用的抽象接口，一个反应堆拥有一个poller，epoll是默认实现，io_uring是可选实现
+class poller
+{
+public:
+    virtual ~poller() {}
+
+    // 初始化，失败返回false，由调用者回退到epoll
+    virtual bool init() = 0;
+    // 注册监听套接字，新连接以EV_ACCEPT上报
+    virtual bool add_listen(int listenfd) = 0;
+    // 注册辅助描述符(eventfd等)，可读时以EV_READ上报，buf为空
+    virtual bool add_watch(int fd) = 0;
+    // 注册新连接，开始等待读事件(oneshot)
+    virtual void add_conn(int fd) = 0;
+    // 重置oneshot事件，ev为EPOLLIN或EPOLLOUT
+    virtual void mod(int fd, int ev) = 0;
+    // 移除连接并关闭描述符
+    virtual void remove(int fd) = 0;
+    // 等待事件，timeout为毫秒，-1表示一直等待，返回事件个数
+    virtual int wait(poll_event *events, int max_events, int timeout) = 0;
+
+    // 是否是完成模型(io_uring)：读写都由poller完成，否则反应堆在事件就绪时自己recv/writev
+    virtual bool completion() { return false; }
+    // 提交异步写，link_recv为true时把下一次读链接在写后面，省一次提交
+    virtual void submit_write(int fd, const struct iovec *iov, int iov_count, bool link_recv) {}
+    // 归还EV_READ事件的缓冲区
+    virtual void recycle(const poll_event &ev) {}
+};
+
+// 根据名字创建并初始化poller，"uring"为io_uring，其他为epoll，io_uring不可用时回退到epoll
+poller *create_poller(const char *backend);
+
+#endif
@@ -0,0 +1,408 @@
+#define LOG_MODULE LOG_HTTP
+#include "reactor.h"
+
+static void show_error(int connfd, const char *info)
+{
+    printf("%s", info);
+    send(connfd, info, strlen(info), 0);
+    close(connfd);
+}
+
+reactor::reactor(int port, threadpool<http_conn> *pool, const char *backend) :
+        m_port(port), m_listenfd(-1), m_backend(backend), m_poller(nullptr), m_wakefd(-1),
+        m_timerfd(-1), m_tid(0), m_stop(false), m_pool(pool), m_rejected(0), m_events(nullptr)
+{
+    // V1：http_conn *users=new http_conn[MAX_FD];// 静态数组法
+    // V2：std::vector<http_conn> users;// vector版本
+    // V3：创建一个week智能指针数组来管理每一个连接对象
+    // V4：智能指针数组和一个指向该数组的unique指针
+    // V5：每个反应堆一张连接表，fd只会被一个反应堆accept，各表之间互不共享
+    m_users = std::make_unique<SPHttp[]>(MAX_FD);
+    m_events = new poll_event[MAX_EVENT_NUMBER];
+    m_batch.reserve(MAX_EVENT_NUMBER);
+}
+
+reactor::~reactor()
+{
+    delete m_poller;
+    if (m_listenfd != -1) close(m_listenfd);
+    if (m_wakefd != -1) close(m_wakefd);
+    if (m_timerfd != -1) close(m_timerfd);
+    delete[] m_events;
+}
+
+bool reactor::init()
+{
+    // 创建监听套接字
+    m_listenfd = socket(PF_INET, SOCK_STREAM, 0);
+    if (m_listenfd == -1) {
+        perror("socket");
+        return false;
+    }
+
+    // 设置端口复用，每个反应堆绑定同一个端口，由内核做负载均衡
+    // SO_REUSEADDR让重启时旧连接还在TIME_WAIT也能绑定
+    int opt = 1;
+    setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+
+    // 绑定
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(m_port);
+    if (bind(m_listenfd, (struct sockaddr*)&address, sizeof(address)) == -1) {
+        perror("bind");
+        return false;
+    }
+
+    // 监听
+    if (listen(m_listenfd, 1024) == -1) {
+        perror("listen");
+        return false;
+    }
+
+    // 创建poller，io_uring不可用时回退到epoll
+    m_poller = create_poller(m_backend);
+    if (m_poller == nullptr) {
+        perror("create poller");
+        return false;
+    }
+    m_poller->add_listen(m_listenfd);
+
+    // 唤醒描述符，stop()时写入，让事件循环立即返回
+    m_wakefd = eventfd(0, EFD_NONBLOCK);
+    if (m_wakefd == -1) {
+        perror("eventfd");
+        return false;
+    }
+    m_poller->add_watch(m_wakefd);
+
+    // 定时器描述符，使用单调时钟，和定时器队列的steady_clock一致
+    m_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_timerfd == -1) {
+        perror("timerfd_create");
+        return false;
+    }
+    m_poller->add_watch(m_timerfd);
+    return true;
+}
+
+void *reactor::worker(void *arg)
+{
+    reactor *r = (reactor *)arg;
+    r->loop();
+    return r;
+}
+
+bool reactor::start(int cpu)
+{
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    // 多反应堆模式下第i个反应堆固定在第i % CPU数个CPU上，连接从建立到关闭都不离开这个CPU
+    if (cpu >= 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu % (ncpu > 0 ? ncpu : 1), &set);
+        pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+    }
+    bool ok = pthread_create(&m_tid, &attr, worker, this) == 0;
+    pthread_attr_destroy(&attr);
+    return ok;
+}
+
+void reactor::join()
+{
+    if (m_tid) {
+        pthread_join(m_tid, NULL);
+        m_tid = 0;
+    }
+}
+
+void reactor::stop()
+{
+    m_stop = true;
+    uint64_t one = 1;
+    ::write(m_wakefd, &one, sizeof(one));
+}
+
+// 清理超时连接，一个反应堆只清理自己定时器队列中的连接
+void reactor::timer_handler()
+{
+    LOG_TO(LOG_TIMER, LOG_LEVEL_INFO, "%s, current client numbers are %d ", "The timer tick is working ...", http_conn::m_user_count.load());
+    if (m_rejected > 0) {
+        LOG_TO(LOG_POOL, LOG_LEVEL_WARN, "server overloaded, %ld requests rejected with 503, queue size %d, queue wait %ldus, buffer blocks in use %ld",
+            m_rejected, m_pool ? m_pool->queue_size() : 0, m_pool ? (long)m_pool->queue_wait() : 0L,
+            block_pool::GetInstance()->used());
+        m_rejected = 0;
+    }
+    response_cache *responses = response_cache::GetInstance();
+    LOG_TO(LOG_SERVER, LOG_LEVEL_INFO, "file cache hits %ld misses %ld, response cache hits %ld misses %ld evictions %ld",
+        file_cache::GetInstance()->hits(), file_cache::GetInstance()->misses(),
+        responses->hits(), responses->misses(), responses->evictions());
+
+    m_timer_wheel.tick();// 调用定时器的tick()函数，心搏函数
+}
+
+// timerfd只在最早的超时时间比已设置的更早时才重新设置，
+// 连接刷新定时器只会让超时时间变晚，不需要系统调用，提前触发时tick()什么也不做，再按新的最早时间设置即可
+void reactor::reset_timer()
+{
+    if (m_timer_wheel.empty()) {
+        return;
+    }
+    time_p expire = m_timer_wheel.nextExpire();
+    if (m_armed != time_p() && m_armed <= expire) {
+        return;
+    }
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(expire.time_since_epoch()).count();
+    // it_value全为0会关闭定时器，已经过期的时间至少设为1纳秒，马上触发
+    if (ns <= 0) ns = 1;
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = ns / 1000000000;
+    its.it_value.tv_nsec = ns % 1000000000;
+    timerfd_settime(m_timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+    m_armed = expire;
+}
+
+void reactor::submit_batch()
+{
+    if (m_batch.empty()) {
+        return;
+    }
+    int n = (int)m_batch.size();
+    int ret = m_pool->append_batch(m_batch.data(), n);
+    // 队列满放不下的请求，直接回复503，不能让连接一直挂着等超时
+    for (int i = ret; i < n; ++i) {
+        m_batch[i]->reject_busy();
+    }
+    m_rejected += n - ret;
+    m_batch.clear();
+}
+
+void reactor::deal_accept(int connfd)
+{
+    // 准备接收客户端信息
+    struct sockaddr_in client_address;
+    socklen_t client_addlen = sizeof(client_address);
+
+    if (connfd < 0) {
+        connfd = accept(m_listenfd, (struct sockaddr*)&client_address, &client_addlen);
+    }
+    else {
+        // io_uring已经accept好了，只需要取对端地址
+        getpeername(connfd, (struct sockaddr*)&client_address, &client_addlen);
+    }
+
+    if (connfd < 0) {
+        // 多个反应堆时，其他线程可能已经把连接取走了
+        if (errno != EAGAIN) {
+            LOG_ERROR("%s:errno is:%d", "accept error", errno);
+        }
+        return;
+    }
+    if (http_conn::m_user_count >= MAX_FD) {
+        // 最大支持的连接数已满
+        // 给客户端写一个信息：服务器内部正忙
+        show_error(connfd, "Internal Server Busy!");
+        LOG_WARN("%s", "Internal server busy！");
+        return;
+    }
+    /*
+    判断智能指针管理的对象是否被销毁，
+        1.如果不存在：初始化一个连接对象，交给它管理。初始化，同时创建定时器。
+        2.如果存在：说明当前管理的这个连接对象已经被初始化了，但是还没被释放，只需要更新它的值
+    */
+    if (m_users[connfd].get() == nullptr)
+    {
+        // 让这个shared智能指针指向一个连接类对象
+        m_users[connfd] = std::make_shared<http_conn>();
+        // 正式对成员初始化，连接注册到本反应堆的poller和连接表
+        m_users[connfd]->init(connfd, client_address, m_poller, m_users.get());
+        // 把连接对象中嵌入的定时器链接到时间轮，不需要分配内存
+        m_timer_wheel.add_timer(&m_users[connfd]->timer, 3 * TIMESLOT);
+        // 打印日志
+        LOG_INFO("Connecting to a new client(%s) cfd(%d) ", inet_ntoa(client_address.sin_addr), connfd);
+    }
+    else
+    {
+        m_users[connfd]->init(connfd, client_address, m_poller, m_users.get()); // 重新初始化该连接对象
+        m_users[connfd]->timer.upadte(3 * TIMESLOT); // 更新该连接对象的定时器
+        m_users[connfd]->timer.cancelDeleted(); // 重新连接就取消删除标记
+        LOG_INFO("Reconnecting to a new client(%s) cfd(%d) ", inet_ntoa(client_address.sin_addr), connfd);
+    }
+}
+
+void reactor::deal_read(poll_event &ev)
+{
+    int sockfd = ev.fd;
+    // 内存预算：空闲连接上的新请求要重新取缓冲块，超出预算时直接拒绝，已经读了一部分的请求继续处理
+    if (m_users[sockfd]->idle() && block_pool::GetInstance()->over_budget()) {
+        m_poller->recycle(ev);
+        m_users[sockfd]->reject_busy();
+        ++m_rejected;
+        return;
+    }
+    // epoll：非阻塞IO，一次性把所有数据都读完，从通信缓冲区读到该对象的读缓冲区内
+    // io_uring：数据已经在provided buffer中，拷贝到读缓冲区后马上归还
+    bool ok = m_poller->completion() ? m_users[sockfd]->read_from(ev.buf, ev.res) : m_users[sockfd]->read();
+    m_poller->recycle(ev);
+    if (ok)
+    {
+        LOG_DEBUG("Deal with the client(%s) cfd(%d)", inet_ntoa(m_users[sockfd]->get_address()->sin_addr), sockfd);
+        // 有数据传输，更新该客户端的定时器
+        m_users[sockfd]->timer.upadte(3 * TIMESLOT);
+        deal_request(sockfd);
+    }
+    // 对方异常断开或者错误事件，和处理错误事件一样
+    else
+    {
+        LOG_ERROR("Read error in client(%s) cfd(%d)", inet_ntoa(m_users[sockfd]->get_address()->sin_addr), sockfd);
+        // 断开连接，关闭掉这个curfd的事件监听，同时标记删除定时器
+        m_users[sockfd]->close_conn();
+    }
+}
+
+void reactor::deal_request(int sockfd)
+{
+    if (m_pool && m_pool->overloaded()) {
+        // 准入控制：工作线程已经处理不过来，排队只会让所有请求都超时，在IO线程直接拒绝
+        m_users[sockfd]->reject_busy();
+        ++m_rejected;
+    }
+    else if (m_pool) {
+        // 先收集起来，本轮事件处理完后整批放入线程池的请求队列，只同步一次
+        // 交给工作线程去解析，工作线程解析请求后，把响应信息放到写缓冲区
+        m_batch.push_back(m_users[sockfd].get()); // 把原始指针传过去
+    }
+    else {
+        // 多反应堆模式，直接在本线程解析，连接不离开当前CPU，没有排队时间
+        m_users[sockfd]->queued_at = time_p();
+        m_users[sockfd]->process();
+    }
+}
+
+void reactor::deal_write(int sockfd)
+{
+    // io_uring：提交异步写，长连接把下一次读链接在写后面
+    struct iovec *iov;
+    int iov_count;
+    if (m_poller->completion() && (iov_count = m_users[sockfd]->get_write_iov(&iov)) > 0)
+    {
+        m_poller->submit_write(sockfd, iov, iov_count, m_users[sockfd]->is_linger());
+        return;
+    }
+    // 非阻塞IO，一次性写完所有数据，包括响应消息和html资源两部分
+    // 从对象的写缓冲区发送到通信缓冲区
+    if (m_users[sockfd]->write())
+    {
+        // 写事件日志
+        LOG_DEBUG("Send data to client(%s) cfd(%d)", inet_ntoa(m_users[sockfd]->get_address()->sin_addr), sockfd);
+        //更新该客户端的定时器
+        m_users[sockfd]->timer.upadte(3 * TIMESLOT);
+        // 流水线请求没处理完，接着处理读缓冲区中剩下的请求
+        if (m_users[sockfd]->pipelined()) {
+            deal_request(sockfd);
+        }
+    }
+    //如果发生写错误 或 对方已经关闭连接，则服务端也关闭连接，标记删除定时器
+    else
+    {
+        // 短连接测试不建议打印此条日志
+        //LOG_ERROR("Write error in client(%s) cfd(%d)", inet_ntoa(m_users[sockfd]->get_address()->sin_addr), sockfd);
+        m_users[sockfd]->close_conn();
+    }
+}
+
+void reactor::deal_written(poll_event &ev)
+{
+    int sockfd = ev.fd;
+    int ret = -1;
+    if (ev.res >= 0) {
+        ret = m_users[sockfd]->advance(ev.res);
+    }
+    else if (ev.res == -EAGAIN) {
+        ret = 1;
+    }
+    // 没写完，继续提交剩下的部分
+    if (ret > 0) {
+        deal_write(sockfd);
+    }
+    else if (ret == 0) {
+        LOG_DEBUG("Send data to client(%s) cfd(%d)", inet_ntoa(m_users[sockfd]->get_address()->sin_addr), sockfd);
+        m_users[sockfd]->timer.upadte(3 * TIMESLOT);
+        if (m_users[sockfd]->pipelined()) {
+            deal_request(sockfd);
+        }
+    }
+    else {
+        m_users[sockfd]->close_conn();
+    }
+}
+
+void reactor::loop()
+{
+    // 每个反应堆用自己的timerfd驱动定时器队列，超时事件和IO事件一起从poller返回，
+    // 不再依赖进程级的alarm()和信号，精度为毫秒
+    while (!m_stop)
+    {
+        // 持续监听，定时由timerfd负责，不需要超时
+        int num = m_poller->wait(m_events, MAX_EVENT_NUMBER, -1);
+        // 忽略因信号引起的中断
+        if ((num < 0) && (errno != EINTR)) {
+            LOG_ERROR("epoll failure!");
+            break;
+        }
+
+        //循环遍历事件数组
+        for (int i = 0; i < num; i++)
+        {
+            poll_event &ev = m_events[i];
+            switch (ev.type)
+            {
+            //1. 有客户端连接进来
+            case EV_ACCEPT:
+                deal_accept(ev.res);
+                break;
+            //2. 处理客户端读事件，或者被其他线程唤醒，m_stop已经设置，或者定时器到期
+            case EV_READ:
+                if (ev.fd == m_wakefd) {
+                    uint64_t cnt;
+                    ::read(m_wakefd, &cnt, sizeof(cnt));
+                }
+                else if (ev.fd == m_timerfd) {
+                    uint64_t cnt;
+                    ::read(m_timerfd, &cnt, sizeof(cnt));
+                    m_armed = time_p();
+                    // 执行定时清理
+                    timer_handler();
+                }
+                else {
+                    deal_read(ev);
+                }
+                break;
+            //3. 处理客户端写事件
+            case EV_WRITE:
+                deal_write(ev.fd);
+                break;
+            //4. 异步写完成
+            case EV_WRITTEN:
+                deal_written(ev);
+                break;
+            //5. 处理错误信息事件，客户端关闭连接，移除对应的定时器
+            case EV_ERROR:
+                LOG_ERROR("Eroor messages or FIN in client(%s) cfd(%d)", inet_ntoa(m_users[ev.fd]->get_address()->sin_addr), ev.fd);
+                // 对方异常断开或者错误事件
+                m_users[ev.fd]->close_conn();
+                break;
+            }
+        }
+        // 本轮读到的请求一次交给线程池
+        submit_batch();
+        // 新连接或定时清理之后，最早的超时时间可能提前了，调整timerfd
+        reset_timer();
+    }
+}
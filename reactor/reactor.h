@@ -0,0 +1,79 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <pthread.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "../http/http_conn.h"
+#include "../threadpool/threadpool.h"
+#include "../Timer_lst/wheelTimer.h"
+#include "../logs/log.h"
+#include "poller.h"
+
+#define MAX_FD 65535 // 最大的文件描述符个数
+#define MAX_EVENT_NUMBER 15000 // 监听的最大的事件数量
+
+// 设置非阻塞文件描述符
+extern int setnonblocking( int fd );
+
+/*
+    反应堆类：one loop per thread
+    每个reactor独占一个poller(epoll或io_uring)、一个SO_REUSEPORT监听套接字、一张连接表和一个定时器队列(由timerfd驱动)，
+    内核按四元组把新连接分散到各个监听套接字上，连接从accept到关闭都只在同一个线程上处理。
+    1.单反应堆模式：pool不为空，主线程只负责IO，请求交给线程池解析(模拟Proactor)
+    2.多反应堆模式：pool为空，每个反应堆线程自己完成读、解析、写，连接不跨线程
+*/
+class reactor
+{
+public:
+    reactor(int port, threadpool<http_conn> *pool = nullptr, const char *backend = "epoll");
+    ~reactor();
+
+    // 创建监听套接字、poller和唤醒描述符，失败返回false
+    bool init();
+    // 创建线程运行事件循环，cpu>=0时把线程绑定到这个CPU(对CPU数取模)
+    bool start(int cpu = -1);
+    // 等待事件循环线程结束
+    void join();
+    // 通知事件循环退出，可以在其他线程中调用
+    void stop();
+
+private:
+    // 线程入口函数
+    static void *worker(void *arg);
+    // 事件循环
+    void loop();
+
+    void deal_accept(int connfd);       // 处理新连接，connfd为-1时自己accept
+    void deal_read(poll_event &ev);     // 处理读事件
+    void deal_request(int sockfd);      // 读缓冲区中有请求，交给线程池或直接处理
+    void deal_write(int sockfd);        // 处理写事件
+    void deal_written(poll_event &ev);  // 处理异步写完成事件(io_uring)
+    void timer_handler();               // 定时清理超时连接
+    void reset_timer();                 // 按最早的超时时间设置timerfd
+    void submit_batch();                // 把本轮收集到的请求一次提交给线程池
+
+private:
+    int m_port;                 // 监听端口
+    int m_listenfd;             // 本反应堆的监听套接字
+    const char *m_backend;      // IO多路复用后端，epoll/uring
+    poller *m_poller;           // 本反应堆的poller
+    int m_wakefd;               // eventfd，用于跨线程唤醒事件循环
+    int m_timerfd;              // timerfd，在最早的超时时间到达时可读，驱动定时器队列
+    time_p m_armed;             // timerfd当前设置的超时时间，没有设置时为time_p()
+    pthread_t m_tid;            // 事件循环线程
+    std::atomic<bool> m_stop;   // 是否结束事件循环
+
+    threadpool<http_conn> *m_pool;  // 线程池，多反应堆模式为空
+    std::vector<http_conn *> m_batch;   // 本轮事件中读到完整数据、等待交给线程池的连接
+    long m_rejected;                // 上次定时清理以来因过载拒绝的请求数
+    timerWheel m_timer_wheel;       // 本反应堆的时间轮
+    std::unique_ptr<SPHttp[]> m_users; // 本反应堆的连接表，以fd为下标
+    poll_event *m_events;           // 就绪事件数组
+};
+
+#endif
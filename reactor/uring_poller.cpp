@@ -0,0 +1,456 @@
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <errno.h>
+#include "uring_poller.h"
+#include "../logs/log.h"
+
+// 提交的操作类型，和fd、代数、recv序号一起编码进user_data
+enum { OP_ACCEPT = 1, OP_RECV, OP_SEND, OP_WATCH, OP_CANCEL, OP_CLOSE };
+
+#define BUF_GROUP 0     // provided buffer组号
+
+// user_data：低20位fd，4位操作类型，20位连接代数，20位recv序号
+static inline uint64_t make_data(int fd, int op, unsigned gen = 0, unsigned rseq = 0)
+{
+    return (uint64_t)(fd & 0xfffff) | ((uint64_t)op << 20) |
+           ((uint64_t)(gen & 0xfffff) << 24) | ((uint64_t)(rseq & 0xfffff) << 44);
+}
+static inline int data_fd(uint64_t d) { return d & 0xfffff; }
+static inline int data_op(uint64_t d) { return (d >> 20) & 0xf; }
+static inline unsigned data_gen(uint64_t d) { return (d >> 24) & 0xfffff; }
+static inline unsigned data_rseq(uint64_t d) { return (d >> 44) & 0xfffff; }
+
+uring_poller::uring_poller(unsigned entries, int buf_count, int buf_size) :
+        m_entries(entries), m_ringfd(-1), m_listenfd(-1),
+        m_sq_ptr(MAP_FAILED), m_sq_size(0), m_sq_local_tail(0),
+        m_sqes((io_uring_sqe *)MAP_FAILED), m_sqes_size(0),
+        m_cq_ptr(MAP_FAILED), m_cq_size(0),
+        m_buf_ring((io_uring_buf_ring *)MAP_FAILED), m_buf_ring_size(0), m_bufs(nullptr),
+        m_buf_count(buf_count), m_buf_size(buf_size), m_buf_tail(0)
+{
+}
+
+uring_poller::~uring_poller()
+{
+    if (m_sq_ptr != MAP_FAILED) munmap(m_sq_ptr, m_sq_size);
+    if (m_cq_ptr != MAP_FAILED) munmap(m_cq_ptr, m_cq_size);
+    if (m_sqes != MAP_FAILED) munmap(m_sqes, m_sqes_size);
+    if (m_buf_ring != MAP_FAILED) munmap(m_buf_ring, m_buf_ring_size);
+    if (m_ringfd != -1) close(m_ringfd);
+    delete[] m_bufs;
+}
+
+bool uring_poller::init()
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    // 完成队列开大一些，一轮事件循环可能有大量完成事件
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+    p.cq_entries = m_entries * 4;
+    m_ringfd = syscall(__NR_io_uring_setup, m_entries, &p);
+    if (m_ringfd < 0) {
+        // 老内核不支持COOP_TASKRUN，去掉再试一次
+        p.flags = IORING_SETUP_CQSIZE;
+        m_ringfd = syscall(__NR_io_uring_setup, m_entries, &p);
+    }
+    if (m_ringfd < 0) {
+        LOG_WARN("io_uring_setup failed, errno is:%d", errno);
+        return false;
+    }
+    // 需要io_uring_enter带超时参数
+    if (!(p.features & IORING_FEAT_EXT_ARG)) {
+        LOG_WARN("%s", "io_uring has no IORING_FEAT_EXT_ARG");
+        return false;
+    }
+
+    // 映射提交队列、完成队列和SQE数组
+    m_sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    m_sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    m_sq_ptr = mmap(0, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringfd, IORING_OFF_SQ_RING);
+    m_cq_ptr = mmap(0, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringfd, IORING_OFF_CQ_RING);
+    m_sqes = (io_uring_sqe *)mmap(0, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringfd, IORING_OFF_SQES);
+    if (m_sq_ptr == MAP_FAILED || m_cq_ptr == MAP_FAILED || m_sqes == MAP_FAILED) {
+        LOG_WARN("io_uring mmap failed, errno is:%d", errno);
+        return false;
+    }
+    char *sq = (char *)m_sq_ptr;
+    m_sq_head = (unsigned *)(sq + p.sq_off.head);
+    m_sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    m_sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    m_sq_array = (unsigned *)(sq + p.sq_off.array);
+    m_sq_local_tail = *m_sq_tail;
+    m_entries = p.sq_entries;
+    char *cq = (char *)m_cq_ptr;
+    m_cq_head = (unsigned *)(cq + p.cq_off.head);
+    m_cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    m_cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    m_cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    // 注册provided buffer ring，内核收到数据时从这里取缓冲区
+    m_buf_ring_size = m_buf_count * sizeof(struct io_uring_buf);
+    m_buf_ring = (io_uring_buf_ring *)mmap(0, m_buf_ring_size, PROT_READ | PROT_WRITE,
+                                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m_buf_ring == MAP_FAILED) {
+        return false;
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)m_buf_ring;
+    reg.ring_entries = m_buf_count;
+    reg.bgid = BUF_GROUP;
+    if (syscall(__NR_io_uring_register, m_ringfd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        LOG_WARN("io_uring register buffer ring failed, errno is:%d", errno);
+        return false;
+    }
+    m_bufs = new char[(size_t)m_buf_count * m_buf_size];
+    for (int i = 0; i < m_buf_count; ++i) {
+        poll_event ev;
+        ev.buf = m_bufs + (size_t)i * m_buf_size;
+        ev.bid = i;
+        put_buf(ev);
+    }
+    return true;
+}
+
+uring_poller::fd_state &uring_poller::state(int fd)
+{
+    if ((size_t)fd >= m_fds.size()) {
+        fd_state st;
+        memset(&st, 0, sizeof(st));
+        m_fds.resize(fd + 1, st);
+    }
+    return m_fds[fd];
+}
+
+struct io_uring_sqe *uring_poller::get_sqe()
+{
+    unsigned head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    // 提交队列满了，先提交一次
+    if (m_sq_local_tail - head >= m_entries) {
+        enter(m_sq_local_tail - head, 0, 0);
+        head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+        if (m_sq_local_tail - head >= m_entries) {
+            return nullptr;
+        }
+    }
+    unsigned idx = m_sq_local_tail & *m_sq_mask;
+    struct io_uring_sqe *sqe = &m_sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    m_sq_array[idx] = idx;
+    m_sq_local_tail++;
+    return sqe;
+}
+
+// 提交并等待完成事件，timeout为毫秒，-1一直等待
+int uring_poller::enter(unsigned to_submit, unsigned min_complete, int timeout)
+{
+    // 让内核看到新填的SQE
+    __atomic_store_n(m_sq_tail, m_sq_local_tail, __ATOMIC_RELEASE);
+
+    unsigned flags = IORING_ENTER_EXT_ARG;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask_sz = _NSIG / 8;
+    if (min_complete > 0) {
+        flags |= IORING_ENTER_GETEVENTS;
+        if (timeout >= 0) {
+            ts.tv_sec = timeout / 1000;
+            ts.tv_nsec = (timeout % 1000) * 1000000LL;
+            arg.ts = (uint64_t)&ts;
+        }
+    }
+    return syscall(__NR_io_uring_enter, m_ringfd, to_submit, min_complete, flags, &arg, sizeof(arg));
+}
+
+void uring_poller::prep_accept()
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = m_listenfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    // 新连接直接设置为非阻塞
+    sqe->accept_flags = SOCK_NONBLOCK;
+    sqe->user_data = make_data(m_listenfd, OP_ACCEPT);
+}
+
+void uring_poller::prep_watch(int fd)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = make_data(fd, OP_WATCH);
+}
+
+void uring_poller::prep_recv(int fd)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    if (!sqe) return;
+    fd_state &st = state(fd);
+    st.rseq++;
+    st.recv_armed = true;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->len = m_buf_size;
+    // 不指定缓冲区，数据到达时由内核从buffer ring中选一个
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_GROUP;
+    sqe->user_data = make_data(fd, OP_RECV, st.gen, st.rseq);
+}
+
+bool uring_poller::add_listen(int listenfd)
+{
+    m_listenfd = listenfd;
+    prep_accept();
+    return true;
+}
+
+bool uring_poller::add_watch(int fd)
+{
+    prep_watch(fd);
+    return true;
+}
+
+void uring_poller::add_conn(int fd)
+{
+    fd_state &st = state(fd);
+    st.recv_armed = false;
+    prep_recv(fd);
+}
+
+void uring_poller::mod(int fd, int ev)
+{
+    fd_state &st = state(fd);
+    if (ev & EPOLLIN) {
+        // 链接在写后面的recv已经在内核中了，不用重复提交
+        if (!st.recv_armed) {
+            prep_recv(fd);
+        }
+    }
+    else if (ev & EPOLLOUT) {
+        m_pending_write.push_back(std::make_pair(fd, st.gen));
+    }
+}
+
+void uring_poller::remove(int fd)
+{
+    fd_state &st = state(fd);
+    st.gen++;
+    st.recv_armed = false;
+    // 先取消该fd上所有未完成的操作，再由内核关闭，正在进行的recv会持有文件引用，直接close关不掉
+    struct io_uring_sqe *sqe = get_sqe();
+    if (sqe) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = fd;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+        // 没有可取消的操作时也要继续执行close
+        sqe->flags = IOSQE_IO_HARDLINK;
+        sqe->user_data = make_data(fd, OP_CANCEL);
+    }
+    sqe = get_sqe();
+    if (sqe) {
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = fd;
+        sqe->user_data = make_data(fd, OP_CLOSE);
+    }
+    else {
+        close(fd);
+    }
+}
+
+void uring_poller::submit_write(int fd, const struct iovec *iov, int iov_count, bool link_recv)
+{
+    fd_state &st = state(fd);
+    struct io_uring_sqe *sqe = get_sqe();
+    if (!sqe) {
+        // 提交队列满，下一轮再写
+        m_pending_write.push_back(std::make_pair(fd, st.gen));
+        return;
+    }
+    if (iov_count == 1) {
+        sqe->opcode = IORING_OP_SEND;
+        sqe->addr = (uint64_t)iov[0].iov_base;
+        sqe->len = iov[0].iov_len;
+    }
+    else {
+        memset(&st.msg, 0, sizeof(st.msg));
+        st.msg.msg_iov = (struct iovec *)iov;
+        st.msg.msg_iovlen = iov_count;
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->addr = (uint64_t)&st.msg;
+        sqe->len = 1;
+    }
+    sqe->fd = fd;
+    // MSG_WAITALL：套接字缓冲区满时由内核等待可写后继续发送，否则部分写完也算成功，
+    // 链接的recv会在响应还没发完时开始，读到的流水线请求会在写的过程中被处理
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->user_data = make_data(fd, OP_SEND, st.gen);
+    // 写完整之后才开始下一次读，写出错时链接会被内核取消，recv收到-ECANCELED
+    if (link_recv && !st.recv_armed) {
+        sqe->flags |= IOSQE_IO_LINK;
+        prep_recv(fd);
+    }
+}
+
+void uring_poller::recycle(const poll_event &ev)
+{
+    // 这次recv的数据反应堆已经处理完，之后mod(EPOLLIN)才需要重新提交
+    if (ev.type == EV_READ) {
+        state(ev.fd).recv_armed = false;
+    }
+    put_buf(ev);
+}
+
+void uring_poller::put_buf(const poll_event &ev)
+{
+    if (!ev.buf) return;
+    // 不能用m_buf_ring->bufs，C++下内核头文件的柔性数组包装会多出一个空结构体，偏移不是0
+    struct io_uring_buf *buf = (struct io_uring_buf *)m_buf_ring + (m_buf_tail & (m_buf_count - 1));
+    buf->addr = (uint64_t)ev.buf;
+    buf->len = m_buf_size;
+    buf->bid = ev.bid;
+    m_buf_tail++;
+    __atomic_store_n(&m_buf_ring->tail, m_buf_tail, __ATOMIC_RELEASE);
+}
+
+int uring_poller::wait(poll_event *events, int max_events, int timeout)
+{
+    int num = 0;
+
+    // 1.先上报等待写的连接，不需要系统调用
+    size_t i = 0;
+    for (; i < m_pending_write.size() && num < max_events; ++i) {
+        int fd = m_pending_write[i].first;
+        if (m_pending_write[i].second != state(fd).gen) {
+            continue; // 连接已经关闭
+        }
+        poll_event &ev = events[num++];
+        ev.type = EV_WRITE;
+        ev.fd = fd;
+        ev.res = 0;
+        ev.buf = nullptr;
+        ev.bid = -1;
+    }
+    m_pending_write.erase(m_pending_write.begin(), m_pending_write.begin() + i);
+
+    // 2.提交本轮所有SQE，没有现成的事件时阻塞等待完成事件
+    unsigned to_submit = m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    bool ready = num > 0 || __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE) != *m_cq_head;
+    if (to_submit > 0 || !ready) {
+        int ret = enter(to_submit, ready ? 0 : 1, timeout);
+        if (ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY) {
+            return num > 0 ? num : -1;
+        }
+    }
+
+    // 3.收割完成事件，转换为反应堆的事件
+    unsigned head = *m_cq_head;
+    unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail && num < max_events; ++head)
+    {
+        struct io_uring_cqe *cqe = &m_cqes[head & *m_cq_mask];
+        uint64_t data = cqe->user_data;
+        int fd = data_fd(data);
+        int res = cqe->res;
+        unsigned flags = cqe->flags;
+
+        switch (data_op(data))
+        {
+        case OP_ACCEPT:
+            if (res >= 0) {
+                poll_event &ev = events[num++];
+                ev.type = EV_ACCEPT;
+                ev.fd = m_listenfd;
+                ev.res = res;
+                ev.buf = nullptr;
+                ev.bid = -1;
+            }
+            else {
+                LOG_ERROR("%s:errno is:%d", "io_uring accept error", -res);
+            }
+            // multishot被内核终止了，重新提交
+            if (!(flags & IORING_CQE_F_MORE)) {
+                prep_accept();
+            }
+            break;
+        case OP_WATCH:
+            if (res >= 0) {
+                poll_event &ev = events[num++];
+                ev.type = EV_READ;
+                ev.fd = fd;
+                ev.res = res;
+                ev.buf = nullptr;
+                ev.bid = -1;
+            }
+            if (!(flags & IORING_CQE_F_MORE)) {
+                prep_watch(fd);
+            }
+            break;
+        case OP_RECV:
+        {
+            fd_state &st = state(fd);
+            poll_event ev;
+            ev.type = EV_READ;
+            ev.fd = fd;
+            ev.res = res;
+            ev.buf = nullptr;
+            ev.bid = -1;
+            if (flags & IORING_CQE_F_BUFFER) {
+                ev.bid = flags >> IORING_CQE_BUFFER_SHIFT;
+                ev.buf = m_bufs + (size_t)ev.bid * m_buf_size;
+            }
+            // 已经关闭的连接，丢弃并归还缓冲区
+            if (data_gen(data) != (st.gen & 0xfffff)) {
+                put_buf(ev);
+                break;
+            }
+            // 链接的写没有写完被取消，写完后会重新提交
+            if (res == -ECANCELED) {
+                if (data_rseq(data) == (st.rseq & 0xfffff)) {
+                    st.recv_armed = false;
+                }
+                break;
+            }
+            // 缓冲区暂时用完了，重新提交
+            if (res == -ENOBUFS || res == -EAGAIN) {
+                if (data_rseq(data) == (st.rseq & 0xfffff)) {
+                    prep_recv(fd);
+                }
+                break;
+            }
+            // 有数据的recv在反应堆recycle之前仍然算作没有完成，
+            // 同一批事件中先处理的写完成调用mod(EPOLLIN)时不会再提交一次recv，否则写下一批响应时可能又读到数据
+            events[num++] = ev;
+            break;
+        }
+        case OP_SEND:
+        {
+            if (data_gen(data) != (state(fd).gen & 0xfffff)) {
+                break;
+            }
+            poll_event &ev = events[num++];
+            ev.type = EV_WRITTEN;
+            ev.fd = fd;
+            ev.res = res;
+            ev.buf = nullptr;
+            ev.bid = -1;
+            break;
+        }
+        default:
+            // 取消和关闭的结果不需要处理
+            break;
+        }
+    }
+    __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+    return num;
+}
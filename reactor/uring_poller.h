@@ -0,0 +1,91 @@
+#ifndef URING_POLLER_H
+#define URING_POLLER_H
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <deque>
+#include <vector>
+#include "poller.h"
+
+/*
+    io_uring实现：完成模型，不再是就绪模型
+    1.监听套接字使用multishot accept，一次提交持续产生新连接
+    2.读使用provided buffer ring，内核收到数据时才从共享缓冲池中取缓冲区，连接空闲时不占缓冲区
+    3.写使用send/sendmsg，长连接把下一次recv用IOSQE_IO_LINK链接在写后面，写完整后自动开始读
+    4.所有操作在下一次wait()时批量提交，一轮事件循环只需要一次io_uring_enter
+    io_uring的提交队列不是线程安全的，只能在反应堆线程内使用，所以只支持多反应堆模式
+*/
+class uring_poller : public poller
+{
+public:
+    uring_poller(unsigned entries, int buf_count, int buf_size);
+    ~uring_poller();
+
+    bool init() override;
+    bool add_listen(int listenfd) override;
+    bool add_watch(int fd) override;
+    void add_conn(int fd) override;
+    void mod(int fd, int ev) override;
+    void remove(int fd) override;
+    int wait(poll_event *events, int max_events, int timeout) override;
+
+    bool completion() override { return true; }
+    void submit_write(int fd, const struct iovec *iov, int iov_count, bool link_recv) override;
+    void recycle(const poll_event &ev) override;
+
+private:
+    // 每个fd的状态，用deque保存，扩容时已有元素地址不变，msghdr要一直有效到sendmsg完成
+    struct fd_state
+    {
+        unsigned gen;       // 连接代数，remove时+1，用来丢弃已关闭连接的迟到完成事件
+        unsigned rseq;      // recv提交序号，用来识别被取消的链接recv是否是最新的一次
+        bool recv_armed;    // 是否有recv在内核中等待
+        struct msghdr msg;  // sendmsg参数
+    };
+
+    struct io_uring_sqe *get_sqe();
+    int enter(unsigned to_submit, unsigned min_complete, int timeout);
+    fd_state &state(int fd);
+    void prep_accept();
+    void prep_watch(int fd);
+    void prep_recv(int fd);
+    void put_buf(const poll_event &ev); // 缓冲区放回buffer ring
+
+private:
+    unsigned m_entries;     // 提交队列大小
+    int m_ringfd;           // io_uring描述符
+    int m_listenfd;         // 监听套接字
+
+    // 提交队列
+    void *m_sq_ptr;
+    size_t m_sq_size;
+    unsigned *m_sq_head;
+    unsigned *m_sq_tail;
+    unsigned *m_sq_mask;
+    unsigned *m_sq_array;
+    unsigned m_sq_local_tail;   // 已经填好但还没有对内核可见的尾部
+    struct io_uring_sqe *m_sqes;
+    size_t m_sqes_size;
+
+    // 完成队列
+    void *m_cq_ptr;
+    size_t m_cq_size;
+    unsigned *m_cq_head;
+    unsigned *m_cq_tail;
+    unsigned *m_cq_mask;
+    struct io_uring_cqe *m_cqes;
+
+    // provided buffer ring
+    struct io_uring_buf_ring *m_buf_ring;
+    size_t m_buf_ring_size;
+    char *m_bufs;           // 所有读缓冲区
+    int m_buf_count;        // 缓冲区个数，必须是2的幂
+    int m_buf_size;         // 每个缓冲区大小
+    unsigned short m_buf_tail;
+
+    std::deque<fd_state> m_fds;
+    // mod(EPOLLOUT)的连接，下一次wait()直接以EV_WRITE上报，不需要系统调用
+    std::vector<std::pair<int, unsigned>> m_pending_write;
+};
+
+#endif
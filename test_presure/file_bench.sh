@@ -0,0 +1,49 @@
+#!/bin/bash
+# 静态文件发送方式的对比测试：mmap+writev 和 sendfile(-s)
+# 分别压测小页面(judge.html)和大图片(test1.jpg)
+# 用法：./file_bench.sh [server路径] [端口] [并发数] [秒数] [其他服务器参数...]
+SERVER=${1:-../server}
+PORT=${2:-9006}
+CLIENTS=${3:-500}
+SECONDS_=${4:-10}
+shift 4 2>/dev/null
+WEBBENCH=$(dirname "$0")/webbench-1.5/webbench
+
+for mode in mmap sendfile; do
+    flag=""
+    if [ "$mode" = "sendfile" ]; then
+        flag="-s"
+    fi
+    "$SERVER" "$PORT" 0 $flag "$@" > /dev/null 2>&1 &
+    pid=$!
+    sleep 1
+    for page in judge.html test1.jpg; do
+        result=$("$WEBBENCH" -2 -c "$CLIENTS" -t "$SECONDS_" "http://127.0.0.1:$PORT/$page" 2>&1 | grep -A1 Speed | tr '\n' ' ')
+        printf "%-9s %-11s %s\n" "$mode" "$page" "$result"
+    done
+    kill "$pid"
+    sleep 1
+done
+
+# 发送过程中截断文件：sendfile返回0时必须关闭连接，服务器不能在写循环中空转
+# 在网站根目录(默认../myroot/Web，可用DOC_ROOT指定)放一个64MB的文件，限速下载到一半时截断
+DOC_ROOT=${DOC_ROOT:-$(dirname "$0")/../myroot/Web}
+BIG="$DOC_ROOT/truncate_test.bin"
+head -c $((64 << 20)) /dev/zero > "$BIG"
+"$SERVER" "$PORT" 0 -s "$@" > /dev/null 2>&1 &
+pid=$!
+sleep 1
+curl -s -o /dev/null --limit-rate 2M "http://127.0.0.1:$PORT/truncate_test.bin" &
+cpid=$!
+sleep 1
+truncate -s 1M "$BIG"
+# 截断之后3秒内服务器用掉的CPU时间(时钟滴答，用户态+内核态)
+before=$(awk '{print $14 + $15}' /proc/$pid/stat)
+sleep 3
+after=$(awk '{print $14 + $15}' /proc/$pid/stat)
+if kill -0 "$cpid" 2>/dev/null; then
+    kill "$cpid"
+fi
+printf "%-9s %-11s server cpu ticks in 3s: %s (接近0为正常，空转时约为300)\n" "sendfile" "truncate" "$((after - before))"
+kill "$pid"
+rm -f "$BIG"
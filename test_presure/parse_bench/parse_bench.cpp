@@ -0,0 +1,167 @@
+/*
+    请求头扫描的微基准测试，比较逐字节扫描(原来的parse_line+strncasecmp链)和http_scan的向量化扫描+字段名完美哈希
+    请求是浏览器真实发出的请求头，多个请求连续放在一块缓冲区中，和流水线请求一样
+    输出每个周期处理的字节数和每个请求的耗时
+    编译：make       (SSE2)
+          make avx2  (AVX2)
+*/
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <time.h>
+#include <x86intrin.h>
+#include <string>
+#include "../../http/http_scan.h"
+#include "../../http/http_header.h"
+
+static const char *browser_request =
+    "GET /judge.html HTTP/1.1\r\n"
+    "Host: 192.168.110.129:9006\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "sec-ch-ua-platform: \"Linux\"\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.7\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Referer: http://192.168.110.129:9006/\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "Cookie: _ga=GA1.1.1234567890.1700000000; session=3f9a1c2e7b8d4f60a1b2c3d4e5f60718; theme=dark\r\n"
+    "\r\n";
+
+// 解析结果，防止被编译器优化掉
+struct result {
+    long lines;
+    long keep_alive;
+    long host_len;
+};
+
+// 原来的做法：逐字节找"\r\n"，再用strncasecmp逐个比较字段名
+static void parse_scalar(char *buf, int len, result &r)
+{
+    int start = 0;
+    for (int i = 0; i + 1 < len; ++i) {
+        if (buf[i] != '\r') {
+            continue;
+        }
+        if (buf[i + 1] != '\n') {
+            break;
+        }
+        buf[i] = '\0';
+        char *text = buf + start;
+        if (strncasecmp(text, "Connection:", 11) == 0) {
+            text += 11;
+            text += strspn(text, " \t");
+            if (strcasecmp(text, "keep-alive") == 0) {
+                ++r.keep_alive;
+            }
+        } else if (strncasecmp(text, "Content-Length:", 15) == 0) {
+            text += 15;
+            text += strspn(text, " \t");
+            r.host_len += atol(text);
+        } else if (strncasecmp(text, "Host:", 5) == 0) {
+            text += 5;
+            text += strspn(text, " \t");
+            r.host_len += strlen(text);
+        }
+        buf[i] = '\r';
+        ++r.lines;
+        start = i + 2;
+        ++i;
+    }
+}
+
+// 向量化：一遍扫描得到行尾和':'，字段名查完美哈希表
+static void parse_simd(char *buf, int len, result &r)
+{
+    int pos = 0;
+    while (pos < len) {
+        int colon = -1;
+        int end = pos + scan_line(buf + pos, len - pos, colon);
+        if (end + 1 >= len || buf[end] != '\r' || buf[end + 1] != '\n') {
+            break;
+        }
+        buf[end] = '\0';
+        char *text = buf + pos;
+        if (colon >= 0) {
+            char *value = text + colon + 1;
+            value += strspn(value, " \t");
+            switch (lookup_header(text, colon)) {
+            case HDR_CONNECTION:
+                if (strcasecmp(value, "keep-alive") == 0) {
+                    ++r.keep_alive;
+                }
+                break;
+            case HDR_CONTENT_LENGTH:
+                r.host_len += atol(value);
+                break;
+            case HDR_HOST:
+                r.host_len += strlen(value);
+                break;
+            default:
+                break;
+            }
+        }
+        buf[end] = '\r';
+        ++r.lines;
+        pos = end + 2;
+    }
+}
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+template <typename F>
+static void run(const char *name, F parse, std::string &data, int requests, int rounds)
+{
+    result r = { 0, 0, 0 };
+    // 预热
+    parse(&data[0], data.size(), r);
+
+    r = { 0, 0, 0 };
+    double t0 = now_ns();
+    unsigned long long c0 = __rdtsc();
+    for (int i = 0; i < rounds; ++i) {
+        parse(&data[0], data.size(), r);
+    }
+    unsigned long long cycles = __rdtsc() - c0;
+    double ns = now_ns() - t0;
+
+    double bytes = (double)data.size() * rounds;
+    printf("%-8s %6.2f bytes/cycle  %8.1f ns/request  %.2f GB/s  (lines %ld, keep-alive %ld)\n",
+        name, bytes / cycles, ns / ((double)requests * rounds), bytes / ns,
+        r.lines / rounds, r.keep_alive / rounds);
+}
+
+int main(int argc, char *argv[])
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 20000;
+    // 16个流水线请求放在一起，大约12KB
+    const int requests = 16;
+    std::string data;
+    for (int i = 0; i < requests; ++i) {
+        data += browser_request;
+    }
+#if defined(__AVX2__)
+    printf("scan_line: AVX2\n");
+#elif defined(__SSE2__)
+    printf("scan_line: SSE2\n");
+#else
+    printf("scan_line: scalar\n");
+#endif
+    printf("%d requests, %zu bytes, %d rounds\n", requests, data.size(), rounds);
+    run("scalar", parse_scalar, data, requests, rounds);
+    run("simd", parse_simd, data, requests, rounds);
+    return 0;
+}
@@ -5,8 +5,11 @@
 #include <cstdio>
 #include <exception>
 #include <pthread.h>
+#include <atomic>
+#include <chrono>
 #include "../lock/locker.h"
 #include"../logs/log.h"
+#include "work_queue.h"
 
 // 线程池类，将它定义为模板类是为了代码复用，模板参数T是任务类 
 // 使用模板的好处:
@@ -14,13 +17,36 @@
 // 1.代码复用: 通过使用模板，你可以创建一个通用的线程池，可以处理不同类型的任务，而无需为每种任务类型编写单独的线程池代码。
 
 // 2.类型安全: 模板可以确保类型安全，避免在编译时出现类型错误。
-template<typename T>
+
+// 请求队列策略，编译时选择，例如-DPOOL_QUEUE=steal_queue使用工作窃取
+#ifndef POOL_QUEUE
+#define POOL_QUEUE ring_queue
+#endif
+
+#define MAX_QUEUE_WAIT 50   // 请求在队列中的平均等待时间(毫秒)超过它就认为过载
+
+// 模板参数Queue是请求队列策略，见work_queue.h，默认使用无锁环形队列
+// 任务类T需要提供process()和queued_at(steady_clock::time_point，放入队列的时间，由线程池设置)
+template<typename T, typename Queue = POOL_QUEUE<T> >
 class threadpool {
 public:
     /*thread_number是线程池中线程的数量，max_requests是请求队列中最多允许的、等待处理的请求的数量*/
     threadpool(int thread_number = 8, int max_requests = 15000);
     ~threadpool();
     bool append(T* request);
+    // 一次提交一批请求，返回成功放入的个数，后面的请求因队列满没有放入
+    int append_batch(T** requests, int n);
+    /*
+        准入控制，IO线程在提交前调用，过载时直接拒绝，不再排队
+        1.队列已满
+        2.积压超过线程数，并且最近请求在队列中的平均等待时间超过MAX_QUEUE_WAIT
+        只看等待时间的话，队列排空后没有新的采样，平均值会一直停在高位，所以要同时有积压才算过载
+    */
+    bool overloaded() const;
+    // 队列中等待的请求数
+    int queue_size() const { return m_workqueue.size(); }
+    // 最近的平均排队时间，微秒
+    int64_t queue_wait() const { return m_wait_us.load(std::memory_order_relaxed); }
 
 private:
     /*工作线程运行的函数，它不断从工作队列中取出任务并执行之*/
@@ -38,23 +64,23 @@ private:
     // 请求队列中最多允许的、等待处理的请求的数量  
     int m_max_requests; 
     
-    // 请求队列
-    std::list< T* > m_workqueue;  
+    // 请求队列，同步方式由队列策略决定
+    Queue m_workqueue;
 
-    // 保护请求队列的互斥锁
-    locker m_queuelocker;   
+    // 工作线程编号，线程启动时依次领取
+    std::atomic<int> m_worker_id;
 
-    // 信号量是否有任务需要处理
-    sem m_queuestat;
+    // 请求排队时间的指数加权移动平均(微秒)，工作线程取出请求时更新
+    std::atomic<int64_t> m_wait_us;
 
     // 是否结束线程          
-    bool m_stop;                    
+    std::atomic<bool> m_stop;
 };
 
-template< typename T >
-threadpool< T >::threadpool(int thread_number, int max_requests) : 
-        m_thread_number(thread_number), m_max_requests(max_requests), 
-        m_stop(false), m_threads(NULL) 
+template< typename T, typename Queue >
+threadpool< T, Queue >::threadpool(int thread_number, int max_requests) : 
+        m_thread_number(thread_number), m_threads(NULL), m_max_requests(max_requests), 
+        m_workqueue(max_requests, thread_number), m_worker_id(0), m_wait_us(0), m_stop(false)
 {
 
     if((thread_number <= 0) || (max_requests <= 0) ) {
@@ -66,47 +92,63 @@ threadpool< T >::threadpool(int thread_number, int max_requests) :
         throw std::exception();
     }
 
-    // 创建thread_number 个线程，并将他们设置为脱离线程。
+    // 创建thread_number 个线程，不再设置为脱离线程，析构时要等它们退出，
+    // 否则退出时工作线程还阻塞在已经销毁的队列上
     for ( int i = 0; i < thread_number; ++i ) {
         if(pthread_create(m_threads + i, NULL, worker, this ) ) {
             delete [] m_threads;
             throw std::exception();
         }
-        
-        if( pthread_detach( m_threads[i] ) ) {
-            delete [] m_threads;
-            throw std::exception();
-        }
     }
     std::cout << "Successfully created threads: " << thread_number << std::endl;
-    LOG_INFO("Successfully created threads: %d", thread_number);
+    LOG_TO(LOG_POOL, LOG_LEVEL_INFO, "Successfully created threads: %d", thread_number);
 }
 
-template< typename T >
-threadpool< T >::~threadpool() {
-    delete [] m_threads;
+template< typename T, typename Queue >
+threadpool< T, Queue >::~threadpool() {
     m_stop = true;
+    // 唤醒所有阻塞的工作线程，等待它们处理完手上的请求后退出
+    m_workqueue.stop();
+    for ( int i = 0; i < m_thread_number; ++i ) {
+        pthread_join( m_threads[i], NULL );
+    }
+    delete [] m_threads;
 }
 
-template< typename T >
-bool threadpool< T >::append( T* request )
+template< typename T, typename Queue >
+bool threadpool< T, Queue >::append( T* request )
 {
-    // 操作工作队列时一定要加锁，因为它被所有线程共享。
-    m_queuelocker.lock();
-    // 超出能处理的最大事件数量
-    if ( m_workqueue.size() > m_max_requests ) {
-        m_queuelocker.unlock();
-        return false;
+    request->queued_at = std::chrono::steady_clock::now();
+    // 队列满返回false
+    return m_workqueue.push(request);
+}
+
+template< typename T, typename Queue >
+int threadpool< T, Queue >::append_batch( T** requests, int n )
+{
+    if ( n <= 0 ) {
+        return 0;
+    }
+    // 同一批请求用同一个时间
+    auto now = std::chrono::steady_clock::now();
+    for ( int i = 0; i < n; ++i ) {
+        requests[i]->queued_at = now;
+    }
+    return m_workqueue.push_batch(requests, n);
+}
+
+template< typename T, typename Queue >
+bool threadpool< T, Queue >::overloaded() const
+{
+    int depth = m_workqueue.size();
+    if ( depth >= m_max_requests ) {
+        return true;
     }
-    // 添加到事件队列
-    m_workqueue.push_back(request);
-    m_queuelocker.unlock();
-    m_queuestat.post();//信号量++，此时会在wait()中唤醒一个或多个线程
-    return true;
+    return depth >= m_thread_number && m_wait_us.load(std::memory_order_relaxed) > MAX_QUEUE_WAIT * 1000;
 }
 
-template< typename T >
-void* threadpool< T >::worker( void* arg ) //线程被创建后开始执行
+template< typename T, typename Queue >
+void* threadpool< T, Queue >::worker( void* arg ) //线程被创建后开始执行
 {
     // 将这个传入的void* 参数转换为线程池对象
     threadpool* pool = ( threadpool* )arg;
@@ -114,24 +156,21 @@ void* threadpool< T >::worker( void* arg ) //线程被创建后开始执行
     return pool;
 }
 
-template< typename T >
-void threadpool< T >::run() {
+template< typename T, typename Queue >
+void threadpool< T, Queue >::run() {
 
+    int id = m_worker_id++;
     while (!m_stop) {
-        // 获取任务，如果信号量为0，则阻塞在此
-        m_queuestat.wait();//信号量--
-        m_queuelocker.lock();
-        // 下面两个判断可省略
-        if ( m_workqueue.empty() ) {
-            m_queuelocker.unlock();
-            continue;
-        }
-        T* request = m_workqueue.front();
-        m_workqueue.pop_front();
-        m_queuelocker.unlock();
+        // 获取任务，没有任务时阻塞在此
+        T* request = m_workqueue.pop(id);
         if ( !request ) {
             continue;
         }
+        // 更新平均排队时间，权重1/8，多个工作线程并发更新时丢失个别采样没有关系
+        int64_t wait = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - request->queued_at).count();
+        int64_t avg = m_wait_us.load(std::memory_order_relaxed);
+        m_wait_us.store(avg + (wait - avg) / 8, std::memory_order_relaxed);
         // 执行任务
         request->process();
     }
@@ -0,0 +1,445 @@
+#ifndef WORK_QUEUE_H
+#define WORK_QUEUE_H
+
+#include <list>
+#include <deque>
+#include <atomic>
+#include <exception>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "../lock/locker.h"
+
+/*
+    线程池的请求队列策略，作为threadpool的模板参数，接口统一为：
+        queue(int max_requests, int thread_number)  :   最多允许等待处理的请求数量，工作线程数
+        bool push(T *request)       :   放入请求，队列满返回false
+        int push_batch(T **requests, int n) :   一次放入一批请求，只同步一次、只唤醒需要的线程数，返回放入的个数
+        T *pop(int id)              :   编号为id的工作线程取出请求，没有请求时阻塞，stop()之后返回nullptr
+        void stop()                 :   唤醒所有阻塞在pop()中的线程，线程池析构时调用
+        int size()                  :   等待处理的请求数，用于准入控制，可以是近似值
+    1.list_queue    :   原来的实现，std::list+互斥锁+信号量
+    2.ring_queue    :   无锁有界环形队列(默认)
+    3.steal_queue   :   每个工作线程一个本地队列，空闲线程从其他线程窃取
+*/
+
+#define CACHE_LINE 64
+
+// 自旋等待时降低CPU占用，让出流水线给同核的另一个超线程
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+// 原来的请求队列：每个请求一次链表节点分配、一次加锁和一次信号量操作
+template<typename T>
+class list_queue {
+public:
+    list_queue(int max_requests, int thread_number) : m_max_requests(max_requests), m_stop(false), m_size(0) {}
+
+    bool push(T *request) {
+        // 操作工作队列时一定要加锁，因为它被所有线程共享。
+        m_queuelocker.lock();
+        // 超出能处理的最大事件数量
+        if ( (int)m_workqueue.size() > m_max_requests ) {
+            m_queuelocker.unlock();
+            return false;
+        }
+        // 添加到事件队列
+        m_workqueue.push_back(request);
+        m_size.store((int)m_workqueue.size(), std::memory_order_relaxed);
+        m_queuelocker.unlock();
+        m_queuestat.post();//信号量++，此时会在wait()中唤醒一个或多个线程
+        return true;
+    }
+
+    int push_batch(T **requests, int n) {
+        // 整批只加一次锁
+        m_queuelocker.lock();
+        int i = 0;
+        for (; i < n && (int)m_workqueue.size() <= m_max_requests; ++i) {
+            m_workqueue.push_back(requests[i]);
+        }
+        m_size.store((int)m_workqueue.size(), std::memory_order_relaxed);
+        m_queuelocker.unlock();
+        for (int k = 0; k < i; ++k) {
+            m_queuestat.post();
+        }
+        return i;
+    }
+
+    T *pop(int id) {
+        // 获取任务，如果信号量为0，则阻塞在此
+        m_queuestat.wait();//信号量--
+        m_queuelocker.lock();
+        if ( m_stop ) {
+            // 依次唤醒下一个阻塞的线程
+            m_queuelocker.unlock();
+            m_queuestat.post();
+            return nullptr;
+        }
+        if ( m_workqueue.empty() ) {
+            m_queuelocker.unlock();
+            return nullptr;
+        }
+        T* request = m_workqueue.front();
+        m_workqueue.pop_front();
+        m_size.store((int)m_workqueue.size(), std::memory_order_relaxed);
+        m_queuelocker.unlock();
+        return request;
+    }
+
+    int size() const {
+        return m_size.load(std::memory_order_relaxed);
+    }
+
+    void stop() {
+        m_queuelocker.lock();
+        m_stop = true;
+        m_queuelocker.unlock();
+        m_queuestat.post();
+    }
+
+private:
+    int m_max_requests;             // 请求队列中最多允许的、等待处理的请求的数量
+    bool m_stop;                    // 是否停止
+    std::atomic<int> m_size;        // 队列长度，不加锁读取
+    std::list< T* > m_workqueue;    // 请求队列
+    locker m_queuelocker;           // 保护请求队列的互斥锁
+    sem m_queuestat;                // 信号量是否有任务需要处理
+};
+
+/*
+    无锁有界多生产者多消费者环形队列(Dmitry Vyukov的算法)
+    1.容量向上取整为2的幂，下标用掩码计算，槽位预先分配，入队出队不分配内存
+    2.每个槽位有一个序号，生产者和消费者各自用CAS抢占位置，抢到后只写自己的槽位，不需要锁
+    3.入队位置、出队位置和休眠计数之间用一个缓存行隔开，生产者和消费者之间没有伪共享
+    4.消费者先自旋一会儿，还没有请求再用event_count在futex上休眠，生产者只在有人休眠时才进入内核
+*/
+template<typename T>
+class ring_queue {
+public:
+    ring_queue(int max_requests, int thread_number) {
+        size_t size = 2;
+        while (size < (size_t)max_requests) {
+            size <<= 1;
+        }
+        m_mask = size - 1;
+        m_buffer = new cell[size];
+        for (size_t i = 0; i < size; ++i) {
+            m_buffer[i].seq.store(i, std::memory_order_relaxed);
+        }
+        m_enqueue_pos.store(0, std::memory_order_relaxed);
+        m_dequeue_pos.store(0, std::memory_order_relaxed);
+        // 单核上自旋只会占用生产者的时间，直接休眠
+        m_spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_COUNT : 0;
+        m_stop.store(false, std::memory_order_relaxed);
+    }
+    ~ring_queue() {
+        delete[] m_buffer;
+    }
+
+    bool push(T *request) {
+        if (!try_push(request)) {
+            return false;
+        }
+        m_waiters.notify_one();
+        return true;
+    }
+
+    int push_batch(T **requests, int n) {
+        int i = 0;
+        while (i < n && try_push(requests[i])) {
+            ++i;
+        }
+        // 一次futex调用最多唤醒i个休眠的线程，醒着的线程自己会取
+        if (i > 0) {
+            m_waiters.notify(i);
+        }
+        return i;
+    }
+
+    T *pop(int id) {
+        T *request;
+        for (;;) {
+            // 先自旋，请求密集时不用睡眠和唤醒
+            for (int i = 0; i < m_spin; ++i) {
+                if (try_pop(request)) {
+                    return request;
+                }
+                cpu_relax();
+            }
+            // 登记等待后再检查一次，避免在检查和睡眠之间错过通知
+            uint32_t key = m_waiters.prepare_wait();
+            if (try_pop(request)) {
+                m_waiters.cancel_wait();
+                return request;
+            }
+            if (m_stop.load(std::memory_order_acquire)) {
+                m_waiters.cancel_wait();
+                return nullptr;
+            }
+            m_waiters.wait(key);
+        }
+    }
+
+    int size() const {
+        size_t tail = m_enqueue_pos.load(std::memory_order_relaxed);
+        size_t head = m_dequeue_pos.load(std::memory_order_relaxed);
+        return tail > head ? (int)(tail - head) : 0;
+    }
+
+    void stop() {
+        m_stop.store(true, std::memory_order_release);
+        m_waiters.notify_all();
+    }
+
+private:
+    static const int SPIN_COUNT = 128;  // 休眠前的自旋次数
+
+    struct cell {
+        std::atomic<size_t> seq;    // 等于位置时可写，等于位置+1时可读
+        T *data;
+    };
+
+    bool try_push(T *request) {
+        cell *c;
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            c = &m_buffer[pos & m_mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0) {
+                if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (dif < 0) {
+                return false;   // 队列满
+            }
+            else {
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        c->data = request;
+        c->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T *&request) {
+        cell *c;
+        size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            c = &m_buffer[pos & m_mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (dif == 0) {
+                if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (dif < 0) {
+                return false;   // 队列空
+            }
+            else {
+                pos = m_dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        request = c->data;
+        // 槽位留给下一圈的生产者
+        c->seq.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    // 用填充隔开，而不是alignas，线程池是new出来的，C++14的new不保证超过16字节的对齐
+    cell *m_buffer;
+    size_t m_mask;
+    int m_spin;                             // 休眠前的自旋次数
+    char m_pad0[CACHE_LINE];
+    std::atomic<size_t> m_enqueue_pos;      // 生产者竞争
+    char m_pad1[CACHE_LINE - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> m_dequeue_pos;      // 消费者竞争
+    char m_pad2[CACHE_LINE - sizeof(std::atomic<size_t>)];
+    event_count m_waiters;                  // 休眠的消费者
+    std::atomic<bool> m_stop;               // 是否停止
+    char m_pad3[CACHE_LINE - sizeof(event_count) - sizeof(std::atomic<bool>)];
+};
+
+/*
+    工作窃取队列：每个工作线程一个本地双端队列
+    1.同一个请求对象(同一个连接)总是放进同一个工作线程的队列，长连接的连续请求留在同一个线程上，缓存是热的
+    2.请求放在队列尾部；工作线程从自己队列的尾部取最新的(缓存最热)，自己的队列空了再从其他线程队列的头部窃取最旧的，
+      被窃取的总是等得最久的请求，不会插到更早的请求前面
+    3.每个本地队列是std::deque加自己的锁，不是Chase-Lev那样的无锁双端队列：生产者是反应堆线程而不是队列的主人，
+      无锁版本的主人端也要和生产者同步，省不掉多少；生产者和窃取者只在同一个队列上才会竞争，不再所有线程争一把锁
+    4.放入请求时，所属线程在休眠就唤醒它，否则唤醒一个休眠的线程来窃取
+*/
+template<typename T>
+class steal_queue {
+public:
+    steal_queue(int max_requests, int thread_number) :
+            m_max_requests(max_requests), m_thread_number(thread_number), m_count(0), m_stop(false) {
+        m_workers = new worker_queue[thread_number];
+    }
+    ~steal_queue() {
+        delete[] m_workers;
+    }
+
+    bool push(T *request) {
+        // 超出能处理的最大事件数量
+        if (m_count.fetch_add(1, std::memory_order_relaxed) >= m_max_requests) {
+            m_count.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+        int home = home_of(request);
+        worker_queue &w = m_workers[home];
+        w.lock.lock();
+        w.tasks.push_back(request);
+        w.lock.unlock();
+
+        // 和pop()中设置sleeping后的再次检查配对，保证不会两边都错过
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (w.sleeping.load(std::memory_order_relaxed)) {
+            w.waiter.notify_one();
+            return true;
+        }
+        for (int k = 1; k < m_thread_number; ++k) {
+            worker_queue &other = m_workers[(home + k) % m_thread_number];
+            if (other.sleeping.load(std::memory_order_relaxed)) {
+                other.waiter.notify_one();
+                break;
+            }
+        }
+        return true;
+    }
+
+    int push_batch(T **requests, int n) {
+        int i = 0;
+        uint64_t touched = 0;   // 放入了新请求的本地队列，超过64个线程时按编号取模，只影响唤醒顺序
+        for (; i < n; ++i) {
+            if (m_count.fetch_add(1, std::memory_order_relaxed) >= m_max_requests) {
+                m_count.fetch_sub(1, std::memory_order_relaxed);
+                break;
+            }
+            int home = home_of(requests[i]);
+            touched |= 1ULL << (home & 63);
+            worker_queue &w = m_workers[home];
+            w.lock.lock();
+            w.tasks.push_back(requests[i]);
+            w.lock.unlock();
+        }
+        if (i == 0) {
+            return 0;
+        }
+        // 整批放完后统一唤醒：先唤醒有新请求的休眠线程，剩下的名额唤醒其他休眠线程来窃取，最多i个
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int wake = i;
+        for (int k = 0; k < m_thread_number && wake > 0; ++k) {
+            worker_queue &w = m_workers[k];
+            if (((touched >> (k & 63)) & 1) && w.sleeping.load(std::memory_order_relaxed)) {
+                w.waiter.notify_one();
+                --wake;
+            }
+        }
+        for (int k = 0; k < m_thread_number && wake > 0; ++k) {
+            worker_queue &w = m_workers[k];
+            if (w.sleeping.load(std::memory_order_relaxed)) {
+                w.waiter.notify_one();
+                --wake;
+            }
+        }
+        return i;
+    }
+
+    T *pop(int id) {
+        worker_queue &self = m_workers[id % m_thread_number];
+        T *request;
+        for (;;) {
+            if (take(id, request)) {
+                return request;
+            }
+            // 登记休眠后再检查一次，避免在检查和睡眠之间错过新请求
+            uint32_t key = self.waiter.prepare_wait();
+            self.sleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (take(id, request)) {
+                self.sleeping.store(false, std::memory_order_relaxed);
+                self.waiter.cancel_wait();
+                return request;
+            }
+            if (m_stop.load(std::memory_order_acquire)) {
+                self.sleeping.store(false, std::memory_order_relaxed);
+                self.waiter.cancel_wait();
+                return nullptr;
+            }
+            self.waiter.wait(key);
+            self.sleeping.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    int size() const {
+        return m_count.load(std::memory_order_relaxed);
+    }
+
+    void stop() {
+        m_stop.store(true, std::memory_order_release);
+        for (int i = 0; i < m_thread_number; ++i) {
+            m_workers[i].waiter.notify_all();
+        }
+    }
+
+private:
+    struct worker_queue {
+        locker lock;                    // 保护本地队列
+        std::deque< T* > tasks;         // 本地队列
+        event_count waiter;             // 该工作线程在这里休眠
+        std::atomic<bool> sleeping;     // 是否在休眠，生产者据此决定唤醒谁
+        char pad[CACHE_LINE];           // 相邻工作线程的队列不在同一个缓存行
+
+        worker_queue() : sleeping(false) {}
+    };
+
+    // 请求对象地址的乘法哈希，同一个连接对象总是落在同一个工作线程
+    int home_of(T *request) const {
+        uint64_t h = (uint64_t)(uintptr_t)request * 0x9E3779B97F4A7C15ULL;
+        return (int)((h >> 32) % (uint64_t)m_thread_number);
+    }
+
+    // 先取自己队列的尾部，再依次从其他线程队列的头部窃取
+    bool take(int id, T *&request) {
+        for (int k = 0; k < m_thread_number; ++k) {
+            worker_queue &w = m_workers[(id + k) % m_thread_number];
+            w.lock.lock();
+            if (w.tasks.empty()) {
+                w.lock.unlock();
+                continue;
+            }
+            if (k == 0) {
+                request = w.tasks.back();
+                w.tasks.pop_back();
+            }
+            else {
+                request = w.tasks.front();
+                w.tasks.pop_front();
+            }
+            w.lock.unlock();
+            m_count.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+private:
+    int m_max_requests;         // 请求队列中最多允许的、等待处理的请求的数量
+    int m_thread_number;        // 工作线程数，也是本地队列数
+    worker_queue *m_workers;    // 本地队列数组
+    std::atomic<int> m_count;   // 所有本地队列中的请求总数
+    std::atomic<bool> m_stop;   // 是否停止
+};
+
+#endif